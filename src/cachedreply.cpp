@@ -0,0 +1,64 @@
+#include "cachedreply.h"
+
+#include <QTimer>
+#include <cstring>
+
+CachedReply::CachedReply(const QNetworkRequest &request, const QByteArray &data, QObject *parent)
+    : QNetworkReply{parent}
+    , mData(data)
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::PostOperation);
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    // Like a real reply, nothing is emitted before the caller connected
+    QTimer::singleShot(0, this, &CachedReply::deliver);
+}
+
+CachedReply::~CachedReply()
+{
+}
+
+void CachedReply::abort()
+{
+    if (isFinished())
+        return;
+
+    setError(QNetworkReply::OperationCanceledError, tr("Operation canceled"));
+    setFinished(true);
+    Q_EMIT finished();
+}
+
+qint64 CachedReply::bytesAvailable() const
+{
+    return mData.size() - mOffset + QNetworkReply::bytesAvailable();
+}
+
+bool CachedReply::isSequential() const
+{
+    return true;
+}
+
+qint64 CachedReply::readData(char *data, qint64 maxSize)
+{
+    const auto size = qMin(maxSize, qint64(mData.size()) - mOffset);
+    if (size <= 0)
+        return isFinished()? -1 : 0;
+
+    std::memcpy(data, mData.constData() + mOffset, size_t(size));
+    mOffset += size;
+    return size;
+}
+
+void CachedReply::deliver()
+{
+    if (isFinished())
+        return;
+
+    // The whole answer is available at once and replayed at full speed
+    Q_EMIT readyRead();
+    setFinished(true);
+    Q_EMIT finished();
+}
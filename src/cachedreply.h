@@ -0,0 +1,30 @@
+#ifndef CACHEDREPLY_H
+#define CACHEDREPLY_H
+
+#include <QNetworkReply>
+
+// Serves a stored response body like a finished network reply, so cached
+// answers go through the same streaming code as live ones.
+class CachedReply : public QNetworkReply
+{
+    Q_OBJECT
+
+public:
+    CachedReply(const QNetworkRequest &request, const QByteArray &data, QObject *parent = nullptr);
+    virtual ~CachedReply();
+
+    void abort() Q_DECL_OVERRIDE;
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+    bool isSequential() const Q_DECL_OVERRIDE;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+
+    void deliver();
+
+private:
+    QByteArray mData;
+    qint64 mOffset = 0;
+};
+
+#endif // CACHEDREPLY_H
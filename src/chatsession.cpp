@@ -1,4 +1,11 @@
 #include "chatsession.h"
+#include "ndjsonreader.h"
+#include "contextmanager.h"
+#include "documentindex.h"
+#include "cachedreply.h"
+#include "jsonwriter.h"
+#include "modelnames.h"
+#include "networkservice.h"
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
@@ -12,13 +19,27 @@
 #include <QJsonArray>
 #include <QVariantMap>
 #include <QTimer>
+#include <QCryptographicHash>
 #include <QDebug>
 
+#include <array>
+#include <cstring>
+
+#define MESSAGES_PAGE_SIZE 50
+#define CHECKPOINT_INTERVAL 1000
+#define REQUEST_CACHE_CHATS 16
+#define CHAT_CACHE_CHATS 16
+#define CHAT_CACHE_BUDGET (32 * 1024 * 1024)
+
 ChatSession::ChatSession(ChatsModel *model, QObject *parent)
     : QObject{parent}
     , mModel(model)
 {
-    mAm = new QNetworkAccessManager(this);
+    mContext = new ContextManager(this);
+
+    mCheckpointTimer = new QTimer(this);
+    mCheckpointTimer->setInterval(CHECKPOINT_INTERVAL);
+    connect(mCheckpointTimer, &QTimer::timeout, this, &ChatSession::checkpoint);
 }
 
 ChatSession::~ChatSession()
@@ -34,40 +55,490 @@ void ChatSession::setCurrentChat(qint32 newCurrentChat)
 {
     if (mCurrentChat == newCurrentChat)
         return;
-    if (mCurrentChat)
+    jumpTo(newCurrentChat, 0);
+}
+
+void ChatSession::jumpTo(qint32 chatId, qint32 messageId)
+{
+    const auto changed = (mCurrentChat != chatId);
+    if (changed && mCurrentChat)
+    {
         setAutoAnswerModel(QString());
-    mCurrentChat = newCurrentChat;
-    reload();
-    Q_EMIT currentChatChanged();
+        cacheCurrent();
+    }
+    mCurrentChat = chatId;
+    load(messageId);
+    if (changed)
+        Q_EMIT currentChatChanged();
 }
 
 void ChatSession::reload()
 {
+    load(0);
+}
+
+void ChatSession::load(qint32 aroundId)
+{
+    // The view is cleared right away and filled once the storage thread
+    // has loaded the newest page, or the page around aroundId. Results of
+    // older loads are dropped.
+    const auto chatId = mCurrentChat;
+    const auto serial = ++mReloadSerial;
+
     mMessages.clear();
+    mFirstMessage.reset();
+    mHasOlder = false;
+    mHasNewer = (aroundId > 0);
+    mFetching = false;
+    mLoading = (chatId != 0);
+    mSummary = Summary();
 
-    auto db = QSqlDatabase::database(mModel->dbConnection());
-    QSqlQuery q(db);
-    q.prepare("SELECT * FROM messages WHERE chat_id=:chat_id");
-    q.bindValue(":chat_id", mCurrentChat);
-    if (q.exec())
+    // A cached chat is shown right away, without a query
+    if (!mHasNewer && mChatCache.contains(chatId))
     {
-        while (q.next())
+        const auto snapshot = mChatCache.take(chatId);
+        mChatCacheOrder.removeOne(chatId);
+        mChatCacheSize -= snapshot.size;
+
+        mMessages = snapshot.messages;
+        mFirstMessage = snapshot.first;
+        mHasOlder = snapshot.hasOlder;
+        mSummary = snapshot.summary;
+        mLoading = false;
+        appendStreaming();
+        Q_EMIT messagesChanged();
+        return;
+    }
+
+    // Answers still streaming into this chat are not stored yet
+    if (!mHasNewer)
+        appendStreaming();
+
+    Q_EMIT messagesChanged();
+    if (!chatId)
+        return;
+
+    mModel->storage()->read(this, [chatId, aroundId](QSqlDatabase &db){
+        return loadSnapshot(db, chatId, aroundId);
+    }, [this, serial, aroundId](const Snapshot &snapshot){
+        if (serial != mReloadSerial)
+            return;
+
+        // Messages added while the page was loading, like a prompt sent
+        // right away, stay after it. Streaming answers may also have been
+        // checkpointed already, the live copy replaces the stored one.
+        QSet<qint32> ids;
+        for (const auto &msg: std::as_const(mMessages))
+            if (msg->id)
+                ids.insert(msg->id);
+
+        QList<MessagePtr> messages;
+        for (const auto &msg: snapshot.messages)
+            if (!ids.contains(msg->id))
+                messages.append(msg);
+
+        mMessages = messages + mMessages;
+        mFirstMessage = snapshot.first;
+        mHasOlder = snapshot.hasOlder;
+        mSummary = snapshot.summary;
+        mLoading = false;
+        if (mHasNewer && !snapshot.hasNewer)
         {
-            const auto r = q.record();
-            auto msg = MessagePtr::create();
-            msg->id = r.value("id").toInt();
-            msg->model = r.value("model").toString();
-            msg->role = r.value("role").toString();
-            msg->content = r.value("content").toString();
-            msg->datetime = QDateTime::fromMSecsSinceEpoch(r.value("datetime").toLongLong());
+            mHasNewer = false;
+            appendStreaming();
+        }
+        Q_EMIT messagesChanged();
 
-            mMessages.append(msg);
+        if (aroundId > 0)
+        {
+            for (const auto &msg: std::as_const(mMessages))
+            {
+                if (msg->id == aroundId)
+                {
+                    Q_EMIT messageFocused(msg);
+                    break;
+                }
+            }
         }
+    });
+}
+
+ChatSession::Snapshot ChatSession::loadSnapshot(QSqlDatabase &db, qint32 chatId, qint32 aroundId)
+{
+    Snapshot res;
+    if (aroundId > 0)
+    {
+        res.messages = loadMessages(db, chatId, aroundId, MESSAGES_PAGE_SIZE / 2, &res.hasOlder);
+        res.messages += loadMessages(db, chatId, aroundId - 1, MESSAGES_PAGE_SIZE, &res.hasNewer, true);
     }
     else
+    {
+        res.messages = loadMessages(db, chatId, 0, MESSAGES_PAGE_SIZE, &res.hasOlder);
+    }
+
+    if (res.hasOlder)
+    {
+        const auto first = loadMessages(db, chatId, 0, 1, nullptr, true);
+        if (first.count())
+            res.first = first.first();
+    }
+    res.summary = loadSummary(db, chatId);
+    return res;
+}
+
+void ChatSession::prefetch(qint32 chatId)
+{
+    if (!chatId || chatId == mCurrentChat || mChatCache.contains(chatId) || mPrefetching.contains(chatId))
+        return;
+
+    // Results are dropped when the chat changed while its page was loading
+    const auto epoch = mChatEpochs.value(chatId);
+    mPrefetching.insert(chatId);
+    mModel->storage()->read(this, [chatId](QSqlDatabase &db){
+        return loadSnapshot(db, chatId, 0);
+    }, [this, chatId, epoch](const Snapshot &snapshot){
+        mPrefetching.remove(chatId);
+        if (epoch != mChatEpochs.value(chatId) || chatId == mCurrentChat || !mModel->exists(chatId))
+            return;
+
+        insertCache(chatId, snapshot);
+    });
+}
+
+void ChatSession::cacheCurrent()
+{
+    // Only a chat showing its newest messages can be restored as it is
+    if (!mCurrentChat || mLoading || mHasNewer)
+        return;
+
+    Snapshot snapshot;
+    snapshot.messages = mMessages;
+    snapshot.first = mFirstMessage;
+    snapshot.hasOlder = mHasOlder;
+    snapshot.summary = mSummary;
+    insertCache(mCurrentChat, snapshot);
+}
+
+void ChatSession::insertCache(qint32 chatId, Snapshot snapshot)
+{
+    if (mChatCache.contains(chatId))
+    {
+        mChatCacheOrder.removeOne(chatId);
+        mChatCacheSize -= mChatCache.take(chatId).size;
+    }
+
+    // Pages scrolled in are kept too, the budget decides what fits
+    snapshot.size = 0;
+    for (const auto &msg: std::as_const(snapshot.messages))
+        snapshot.size += qint64(sizeof(Message)) + msg->content.size() + msg->reasoning.size() * 2 + msg->json.size();
+    if (snapshot.size > CHAT_CACHE_BUDGET)
+        return;
+
+    mChatCache.insert(chatId, snapshot);
+    mChatCacheOrder.prepend(chatId);
+    mChatCacheSize += snapshot.size;
+
+    while (mChatCacheOrder.count() > CHAT_CACHE_CHATS || mChatCacheSize > CHAT_CACHE_BUDGET)
+        mChatCacheSize -= mChatCache.take(mChatCacheOrder.takeLast()).size;
+}
+
+void ChatSession::invalidateCache(qint32 chatId)
+{
+    mChatEpochs[chatId]++;
+    if (!mChatCache.contains(chatId))
+        return;
+
+    mChatCacheOrder.removeOne(chatId);
+    mChatCacheSize -= mChatCache.take(chatId).size;
+}
+
+void ChatSession::appendStreaming()
+{
+    const auto stream = mStreams.value(mCurrentChat);
+    if (!stream)
+        return;
+
+    // A checkpointed answer can be in the loaded page already, the live
+    // copy replaces the stored one.
+    for (const auto &msg: std::as_const(stream->messages))
+    {
+        auto found = false;
+        for (auto &m: mMessages)
+        {
+            if (m == msg || (msg->id && m->id == msg->id))
+            {
+                m = msg;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            mMessages.append(msg);
+    }
+}
+
+void ChatSession::fetchOlder()
+{
+    if (!mHasOlder || mMessages.isEmpty() || mFetching || mLoading)
+        return;
+
+    const auto chatId = mCurrentChat;
+    const auto serial = mReloadSerial;
+    const auto beforeId = mMessages.first()->id;
+    mFetching = true;
+
+    mModel->storage()->read(this, [chatId, beforeId](QSqlDatabase &db){
+        Page res;
+        res.messages = loadMessages(db, chatId, beforeId, MESSAGES_PAGE_SIZE, &res.hasMore);
+        return res;
+    }, [this, serial, beforeId](const Page &page){
+        if (serial != mReloadSerial)
+            return;
+
+        mFetching = false;
+        prependPage(beforeId, page);
+    });
+}
+
+void ChatSession::prependPage(qint32 beforeId, const Page &page)
+{
+    if (mMessages.isEmpty() || mMessages.first()->id != beforeId)
+        return;
+
+    mHasOlder = page.hasMore;
+    if (!mHasOlder)
+        mFirstMessage.reset();
+    if (page.messages.isEmpty())
+        return;
+
+    mMessages = page.messages + mMessages;
+    Q_EMIT messagesPrepended(page.messages.count());
+}
+
+void ChatSession::fetchNewer()
+{
+    if (!mHasNewer || mMessages.isEmpty() || mFetching || mLoading)
+        return;
+
+    const auto chatId = mCurrentChat;
+    const auto serial = mReloadSerial;
+    const auto afterId = mMessages.last()->id;
+    mFetching = true;
+
+    mModel->storage()->read(this, [chatId, afterId](QSqlDatabase &db){
+        Page res;
+        res.messages = loadMessages(db, chatId, afterId, MESSAGES_PAGE_SIZE, &res.hasMore, true);
+        return res;
+    }, [this, serial, afterId](const Page &page){
+        if (serial != mReloadSerial)
+            return;
+
+        mFetching = false;
+        if (mMessages.isEmpty() || mMessages.last()->id != afterId)
+            return;
+
+        const auto count = mMessages.count();
+        mMessages += page.messages;
+
+        // The end of the chat is reached, streaming answers follow it
+        mHasNewer = page.hasMore;
+        if (!mHasNewer)
+            appendStreaming();
+
+        if (mMessages.count() > count)
+            Q_EMIT messagesAppended(mMessages.count() - count);
+    });
+}
+
+bool ChatSession::hasOlder() const
+{
+    return mHasOlder;
+}
+
+bool ChatSession::hasNewer() const
+{
+    return mHasNewer;
+}
+
+QList<ChatSession::MessagePtr> ChatSession::loadMessages(QSqlDatabase &db, qint32 chatId, qint32 fromId, qint32 limit, bool *hasMore, bool newer)
+{
+    // Keyset pagination on the message id. Pages end before fromId, or at
+    // the newest message for 0. Newer pages start after fromId instead.
+    QString query = QStringLiteral("SELECT m.id, d.name, m.role, m.content, m.datetime, "
+                                   "s.total_duration, s.load_duration, s.prompt_eval_count, s.prompt_eval_duration, "
+                                   "s.eval_count, s.eval_duration, COALESCE(s.time_to_first_byte, -1), COALESCE(s.time_to_first_token, -1), m.reasoning, m.partial "
+                                   "FROM messages m JOIN models d ON d.id = m.model_id LEFT JOIN message_stats s ON s.message_id = m.id WHERE m.chat_id=:chat_id ");
+    if (newer)
+        query += QStringLiteral("AND m.id > :from ORDER BY m.id ASC LIMIT :limit");
+    else if (fromId > 0)
+        query += QStringLiteral("AND m.id < :from ORDER BY m.id DESC LIMIT :limit");
+    else
+        query += QStringLiteral("ORDER BY m.id DESC LIMIT :limit");
+
+    QList<MessagePtr> res;
+
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare(query);
+    q.bindValue(":chat_id", chatId);
+    if (newer || fromId > 0)
+        q.bindValue(":from", fromId);
+    q.bindValue(":limit", limit + 1);
+    if (!q.exec())
+    {
         qDebug() << q.lastError();
+        if (hasMore)
+            *hasMore = false;
+        return res;
+    }
 
-    Q_EMIT messagesChanged();
+    // A page almost always comes from one or two models, so the name is
+    // only looked up when it differs from the previous row's.
+    QString modelName;
+    qint32 model = 0;
+    while (q.next())
+    {
+        const auto name = q.value(1).toString();
+        if (name != modelName)
+        {
+            modelName = name;
+            model = ModelNames::intern(name);
+        }
+
+        auto msg = MessagePtr::create();
+        msg->id = q.value(0).toInt();
+        msg->model = model;
+        msg->role = Role(q.value(2).toInt());
+        msg->content = q.value(3).toString();
+        msg->datetime = QDateTime::fromMSecsSinceEpoch(q.value(4).toLongLong());
+
+        msg->stats.totalDuration = q.value(5).toLongLong();
+        msg->stats.loadDuration = q.value(6).toLongLong();
+        msg->stats.promptEvalCount = q.value(7).toLongLong();
+        msg->stats.promptEvalDuration = q.value(8).toLongLong();
+        msg->stats.evalCount = q.value(9).toLongLong();
+        msg->stats.evalDuration = q.value(10).toLongLong();
+        msg->stats.timeToFirstByte = q.value(11).toLongLong();
+        msg->stats.timeToFirstToken = q.value(12).toLongLong();
+        msg->reasoning = q.value(13).toString();
+        msg->partial = q.value(14).toBool();
+
+        if (newer)
+            res.append(msg);
+        else
+            res.prepend(msg);
+    }
+
+    const auto more = (res.count() > limit);
+    if (more)
+    {
+        if (newer)
+            res.removeLast();
+        else
+            res.removeFirst();
+    }
+    if (hasMore)
+        *hasMore = more;
+
+    return res;
+}
+
+void ChatSession::loadHistory(qint32 chatId, const QString &model, const std::function<void(const QList<MessagePtr>&)> &callback)
+{
+    // Older pages are pulled in until the loaded messages cover the model's
+    // budget, and the chat's first message is always available for pinning.
+    // While the view is still loading its page, the history is read from
+    // the newest stored message instead.
+    const auto loaded = !mLoading && chatId == mCurrentChat;
+    const auto messages = loaded? mMessages : QList<MessagePtr>();
+
+    qint64 tokens = 0;
+    for (const auto &msg: messages)
+        tokens += ContextManager::tokensOf(msg);
+
+    const auto first = mFirstMessage;
+    const auto budget = mContext->budget(model);
+    if (loaded && (!mHasOlder || messages.isEmpty() || tokens >= budget))
+    {
+        auto res = messages;
+        if (mHasOlder && first)
+            res.prepend(first);
+        callback(res);
+        return;
+    }
+
+    const auto serial = mReloadSerial;
+    const auto beforeId = messages.isEmpty()? 0 : messages.first()->id;
+    mModel->storage()->read(this, [chatId, beforeId, missing = budget - tokens, first](QSqlDatabase &db){
+        Page res;
+        res.hasMore = true;
+
+        qint64 tokens = 0;
+        auto before = beforeId;
+        while (res.hasMore && tokens < missing)
+        {
+            const auto page = loadMessages(db, chatId, before, MESSAGES_PAGE_SIZE, &res.hasMore);
+            if (page.isEmpty())
+                break;
+
+            for (const auto &msg: page)
+                tokens += ContextManager::tokensOf(msg);
+
+            res.messages = page + res.messages;
+            before = page.first()->id;
+        }
+
+        if (res.hasMore && !first)
+            res.messages = loadMessages(db, chatId, 0, 1, nullptr, true) + res.messages;
+        else if (res.hasMore)
+            res.messages.prepend(first);
+        return res;
+    }, [this, serial, loaded, beforeId, messages, callback](const Page &page){
+        auto older = page.messages;
+        if (page.hasMore && older.count())
+            older.removeFirst();
+
+        // The pages are kept for the view too, if it still shows this chat
+        if (loaded && serial == mReloadSerial)
+            prependPage(beforeId, Page{older, page.hasMore});
+
+        callback(page.messages + messages);
+    });
+}
+
+void ChatSession::reloadSummary()
+{
+    const auto chatId = mCurrentChat;
+    const auto serial = mReloadSerial;
+    mModel->storage()->read(this, [chatId](QSqlDatabase &db){
+        return loadSummary(db, chatId);
+    }, [this, serial](const Summary &summary){
+        if (serial == mReloadSerial)
+            mSummary = summary;
+    });
+}
+
+ChatSession::Summary ChatSession::loadSummary(QSqlDatabase &db, qint32 chatId)
+{
+    Summary res;
+
+    QSqlQuery q(db);
+    q.prepare("SELECT message_id, content FROM chat_summaries WHERE chat_id=:chat_id");
+    q.bindValue(":chat_id", chatId);
+    if (!q.exec())
+    {
+        qDebug() << q.lastError();
+        return res;
+    }
+    if (!q.next())
+        return res;
+
+    res.upTo = q.value(0).toInt();
+    res.text = q.value(1).toString();
+    res.message = MessagePtr::create();
+    res.message->role = System;
+    res.message->content = QStringLiteral("Summary of the earlier conversation:\n") + res.text;
+    return res;
 }
 
 void ChatSession::sendPrompt(const QString &model, const QString &prompt)
@@ -77,118 +548,385 @@ void ChatSession::sendPrompt(const QString &model, const QString &prompt)
 
 void ChatSession::sendPrompt(const QString &model, const QString &prompt, bool human, bool isAutoSend)
 {
-    mModel->dbBegin();
-
     if (mCurrentChat == 0)
         setCurrentChat(mModel->create(prompt.left(64)));
+    else if (mHasNewer)
+        reload();
 
-    QUrl url(mBaseUrl + "/chat");
+    const auto chatId = mCurrentChat;
+
+    auto promptMsg = MessagePtr::create();
+    promptMsg->datetime = QDateTime::currentDateTime();
+    promptMsg->content = prompt;
+    promptMsg->role = User;
+
+    const auto promptModel = (mAutoAnswerModel.count() && isAutoSend? mAutoAnswerModel : model);
+    promptMsg->model = ModelNames::intern(promptModel);
+
+    // The running answer is stopped first, so what it received so far is
+    // stored before the new prompt and is part of its history
+    stopStream(chatId);
+
+    if (human)
+    {
+        mMessages << promptMsg;
+        store(promptMsg, chatId);
+        Q_EMIT messageInserted(promptMsg);
+    }
+
+    loadHistory(chatId, promptModel, [this, chatId, model, promptModel, promptMsg, human, isAutoSend](const QList<MessagePtr> &history){
+        if (!mDocuments || mDocuments->sources(chatId).isEmpty())
+        {
+            post(chatId, model, promptMsg, history, MessagePtr(), human, isAutoSend);
+            return;
+        }
+
+        // Excerpts of the attached files get at most a quarter of the budget
+        const auto budget = mContext->budget(promptModel) / 4;
+        mDocuments->retrieve(chatId, promptMsg->content.toString(), budget, this, [this, chatId, model, promptMsg, history, human, isAutoSend](const QList<DocumentIndex::Excerpt> &excerpts){
+            MessagePtr documents;
+            if (excerpts.count())
+            {
+                documents = MessagePtr::create();
+                documents->role = System;
+                documents->content = QStringLiteral("Excerpts from the files attached to this conversation:\n\n");
+                for (const auto &e: excerpts)
+                    documents->content += QStringLiteral("%1:\n```\n%2\n```\n\n").arg(e.path, e.text);
+            }
+
+            post(chatId, model, promptMsg, history, documents, human, isAutoSend);
+        });
+    });
+}
+
+void ChatSession::post(qint32 chatId, const QString &model, const MessagePtr &promptMsg, const QList<MessagePtr> &history, const MessagePtr &documents, bool human, bool isAutoSend)
+{
+    // The chat may have been deleted while its history was loading
+    if (!mModel->exists(chatId))
+        return;
 
-    auto buffer = new QByteArray;
+    QUrl url(mBaseUrl + "/chat");
 
     QNetworkRequest req;
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     req.setUrl(url);
 
-    auto promptMsg = MessagePtr::create();
-    promptMsg->datetime = QDateTime::currentDateTime();
-    promptMsg->content = prompt;
-    promptMsg->role = "user";
+    // Only what fits in the model's token budget is sent. Older turns
+    // outside the window are folded into the chat summary when enabled.
+    const auto summary = (chatId == mCurrentChat? mSummary : Summary());
+    const auto promptModel = ModelNames::name(promptMsg->model);
+    const auto window = mContext->select(chatId, promptModel, history, summary.message, documents);
+    if (mContext->compaction() && !window.dropped.isEmpty() && window.dropped.last()->id > summary.upTo)
+        compact(chatId, promptModel, window.dropped);
+
+    const auto body = encodeRequest(chatId, promptModel, window.messages, human);
+    if (!mResponseCache || !mDeterministic)
+    {
+        startStream(chatId, model, req, body, window.tokens, isAutoSend, QByteArray(), QByteArray());
+        return;
+    }
+
+    // The key covers everything that decides the answer, which is the body
+    // up to the end of the messages. Keep alive comes after it.
+    const auto key = QCryptographicHash::hash(QByteArray::fromRawData(body.constData(), mRequests.value(chatId).keyEnd), QCryptographicHash::Sha256);
+    const auto tokens = window.tokens;
+
+    mModel->storage()->read(this, [key](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("SELECT data FROM response_cache WHERE key = :key");
+        q.bindValue(":key", key);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return QByteArray();
+        }
+        if (!q.next())
+            return QByteArray();
 
-    if (mAutoAnswerModel.count())
-        promptMsg->model = isAutoSend? mAutoAnswerModel : model;
+        const auto data = q.value(0).toByteArray();
+
+        q.prepare("UPDATE response_cache SET used_at = :used_at WHERE key = :key");
+        q.bindValue(":used_at", QDateTime::currentMSecsSinceEpoch());
+        q.bindValue(":key", key);
+        if (!q.exec())
+            qDebug() << q.lastError();
+
+        return data;
+    }, [this, chatId, model, req, body, tokens, isAutoSend, key](const QByteArray &cached){
+        if (!mModel->exists(chatId))
+            return;
+        startStream(chatId, model, req, body, tokens, isAutoSend, key, cached);
+    });
+}
+
+QByteArray ChatSession::encodeRequest(qint32 chatId, const QString &model, const QList<MessagePtr> &messages, bool human)
+{
+    QByteArray head;
+    JsonWriter w(head);
+    w.beginObject();
+    w.key("model");
+    w.value(model);
+
+    // The server keeps its own default context otherwise, which is often
+    // smaller than the budget the window was built for
+    w.key("options");
+    w.beginObject();
+    w.key("num_ctx");
+    w.value(mContext->budget(model));
+    if (mDeterministic)
+    {
+        w.key("seed");
+        w.value(mSeed);
+        w.key("temperature");
+        w.value(0);
+    }
+    w.endObject();
+    w.key("messages");
+    w.beginArray();
+
+    mRequestsOrder.removeOne(chatId);
+    mRequestsOrder.prepend(chatId);
+    while (mRequestsOrder.count() > REQUEST_CACHE_CHATS)
+        mRequests.remove(mRequestsOrder.takeLast());
+
+    // The last request of the chat is the buffer for the next one. The
+    // messages both have in common keep their bytes, the body is cut
+    // after them and only the new turn is appended.
+    auto &request = mRequests[chatId];
+    qint32 keep = 0;
+    if (request.head == head)
+    {
+        while (keep < request.sent.count() && keep < messages.count())
+        {
+            const auto &sent = request.sent.at(keep);
+            const auto &msg = messages.at(keep);
+            if (!sent.id || sent.id != msg->id || sent.length != msg->content.size() || sent.role != roleOf(msg, human))
+                break;
+            keep++;
+        }
+    }
     else
-        promptMsg->model = model;
+    {
+        request.head = head;
+        request.sent.clear();
+    }
 
-    if (human)
+    request.sent.erase(request.sent.begin() + keep, request.sent.end());
+    request.body.truncate(keep? request.sent.last().end : 0);
+    if (!keep)
+        request.body += head;
+
+    for (auto i = keep; i < messages.count(); i++)
     {
-        mMessages << promptMsg;
-        store(promptMsg);
+        const auto &msg = messages.at(i);
+        const auto role = roleOf(msg, human);
+        if (request.sent.count())
+            request.body += ',';
+        request.body += encodeMessage(msg, role);
+        request.sent << SentMessage{msg->id, msg->content.size(), role, qint32(request.body.size())};
     }
 
-    QJsonArray chat;
-    for (const auto &msg: mMessages)
+    request.body += ']';
+    request.keyEnd = request.body.size();
+
+    if (mKeepAlive.count())
     {
-        QJsonObject c;
-        if (!human)
-            c["role"] = (msg->role == "user"? "assistant" : msg->role == "user"? "assistant" : "system");
+        bool isNumber = false;
+        const auto seconds = mKeepAlive.toInt(&isNumber);
+        request.body += ",\"keep_alive\":";
+
+        JsonWriter tail(request.body);
+        if (isNumber)
+            tail.value(seconds);
         else
-            c["role"] = msg->role;
-        c["content"] = msg->content;
-        chat << c;
+            tail.value(mKeepAlive);
     }
+    request.body += '}';
 
-    QJsonObject obj;
-    obj["model"] = promptMsg->model;
-    obj["messages"] = chat;
+    return request.body;
+}
+
+ChatSession::Role ChatSession::roleOf(const MessagePtr &msg, bool human)
+{
+    // Auto answers flip the roles, the other model sees its own turns
+    // as the assistant's
+    if (!human)
+        return (msg->role == User? Assistant : System);
+    return msg->role;
+}
+
+ChatSession::Role ChatSession::roleFromName(const QString &name)
+{
+    if (name == QLatin1String("user"))
+        return User;
+    if (name == QLatin1String("assistant"))
+        return Assistant;
+    if (name == QLatin1String("system"))
+        return System;
+    return Tool;
+}
 
-    auto reply = mAm->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact));
+QString ChatSession::roleName(Role role)
+{
+    switch (role)
+    {
+    case User:
+        return QStringLiteral("user");
+    case Assistant:
+        return QStringLiteral("assistant");
+    case System:
+        return QStringLiteral("system");
+    case Tool:
+        break;
+    }
+    return QStringLiteral("tool");
+}
 
-    mActiveReply = reply;
-    mActiveReplyMessages.clear();
+const QByteArray &ChatSession::encodeMessage(const MessagePtr &msg, Role role)
+{
+    // Messages only change while they stream in, and then they grow
+    if (msg->json.isEmpty() || msg->jsonRole != role || msg->jsonLength != msg->content.size())
+    {
+        msg->json.clear();
+        JsonWriter w(msg->json);
+        w.beginObject();
+        w.key("role");
+        w.value(roleName(role));
+        w.key("content");
+        w.value(msg->content);
+        w.endObject();
 
-    const auto readData = [this, reply, buffer](bool finalPart){
-        buffer->append(reply->readAll());
-        while (buffer->contains('\n') || finalPart)
-        {
-            const auto idx = buffer->indexOf('\n');
-            const auto data = finalPart? *buffer : buffer->left(idx+1);
-            buffer->remove(0, idx+1);
+        msg->jsonRole = role;
+        msg->jsonLength = msg->content.size();
+    }
+    return msg->json;
+}
 
-            if (data.isEmpty())
-                return;
+void ChatSession::startStream(qint32 chatId, const QString &model, const QNetworkRequest &req, const QByteArray &body, qint32 promptTokens, bool isAutoSend,
+                              const QByteArray &cacheKey, const QByteArray &cached)
+{
+    // A new prompt in a chat replaces that chat's running stream only; the
+    // aborted stream still stores what it received so far.
+    stopStream(chatId);
 
-            const auto json = QJsonDocument::fromJson(data);
-            if (!json.isObject())
+    auto stream = StreamPtr::create();
+    stream->chatId = chatId;
+    stream->promptTokens = promptTokens;
+    stream->cacheKey = cacheKey;
+    stream->cached = !cached.isEmpty();
+    stream->timer.start();
+
+    // A cached answer is replayed through the same reply handling as a
+    // live one, only without waiting for the server.
+    if (stream->cached)
+        stream->reply = new CachedReply(req, cached, this);
+    else
+        stream->reply = NetworkService::instance()->post(req, body);
+
+    if (cacheKey.count())
+    {
+        if (stream->cached)
+            mCacheHits++;
+        else
+            mCacheMisses++;
+        Q_EMIT cacheStatsChanged();
+    }
+
+    mStreams[chatId] = stream;
+    mCheckpointTimer->start();
+
+    const auto readData = [this, stream](bool finalPart){
+        const auto data = stream->reply->readAll();
+        if (stream->firstByte < 0 && data.count())
+            stream->firstByte = stream->timer.elapsed();
+        if (stream->cacheKey.count() && !stream->cached)
+            stream->raw += data;
+
+        stream->reader.append(data);
+
+        QByteArray line;
+        NdjsonReader::Chunk chunk;
+        while (stream->reader.readLine(line, finalPart))
+        {
+            if (!NdjsonReader::parse(line, chunk))
             {
-                qDebug() << "invalid data:" << data;
-                return;
+                qDebug() << "invalid data:" << line;
+                continue;
             }
 
-            const auto obj = json.object();
-            const auto model = obj.value("model").toString();
-            const auto done = obj.value("done").toBool();
-            const auto message = obj.value("message").toObject();
+            // A replayed answer was not generated now, its timings are
+            // neither shown nor stored
+            if (chunk.done && !stream->cached)
+            {
+                stream->stats.totalDuration = chunk.totalDuration;
+                stream->stats.loadDuration = chunk.loadDuration;
+                stream->stats.promptEvalCount = chunk.promptEvalCount;
+                stream->stats.promptEvalDuration = chunk.promptEvalDuration;
+                stream->stats.evalCount = chunk.evalCount;
+                stream->stats.evalDuration = chunk.evalDuration;
+                recordPromptStats(stream, chunk);
+            }
 
-            const auto role = message.value("role").toString();
-            const auto content = message.value("content").toString();
-            if (content.isEmpty())
+            const auto &role = chunk.role;
+            const auto &content = chunk.content;
+            if (content.isEmpty() && chunk.thinking.isEmpty())
                 continue;
 
-            if (reply == mActiveReply)
+            if (stream->firstToken < 0)
+                stream->firstToken = stream->timer.elapsed();
+
+            const auto visible = (stream->chatId == mCurrentChat && !mHasNewer);
+
+            MessagePtr &responceMsg = stream->messages[role];
+            if (!responceMsg)
             {
-                MessagePtr &responceMsg = mActiveReplyMessages[role];
-                if (!responceMsg)
-                {
-                    responceMsg = MessagePtr::create();
-                    responceMsg->datetime = QDateTime::currentDateTime();
-                    responceMsg->role = role;
-                    responceMsg->model = model;
+                responceMsg = MessagePtr::create();
+                responceMsg->datetime = QDateTime::currentDateTime();
+                responceMsg->role = roleFromName(role);
+                responceMsg->model = ModelNames::intern(chunk.model);
 
+                if (visible)
+                {
                     mMessages.append(responceMsg);
+                    Q_EMIT messageInserted(responceMsg);
                 }
-
-                responceMsg->content += content;
             }
 
-            Q_EMIT messagesChanged();
-            if (finalPart)
-                break;
+            // Reasoning is split from the answer once, as it streams in.
+            // Newer servers send it in its own field instead of in tags.
+            responceMsg->reasoning += chunk.thinking;
+            stream->splitters[role].feed(content, responceMsg->content, responceMsg->reasoning);
+            responceMsg->tokens = -1;
+            stream->dirty = true;
+            if (visible)
+                Q_EMIT messageAppended(responceMsg, content);
         }
     };
 
-    connect(mActiveReply, &QNetworkReply::readyRead, this, [readData](){ readData(false); });
-    connect(mActiveReply, &QNetworkReply::finished, this, [this, reply, buffer, isAutoSend, model, readData](){
+    connect(stream->reply, &QNetworkReply::readyRead, this, [readData](){ readData(false); });
+    connect(stream->reply, &QNetworkReply::finished, this, [this, stream, isAutoSend, model, readData](){
         readData(true);
-        reply->deleteLater();
-        delete buffer;
-        if (reply == mActiveReply)
+        stream->reply->deleteLater();
+
+        const auto chatId = stream->chatId;
+        if (mStreams.value(chatId) == stream)
+            mStreams.remove(chatId);
+        if (mStreams.isEmpty())
+            mCheckpointTimer->stop();
+
+        for (auto i=stream->messages.constBegin(); i!=stream->messages.constEnd(); i++)
+            stream->splitters[i.key()].finish(i.value()->content, i.value()->reasoning);
+
+        if (!stream->discarded)
         {
-            if (mAutoAnswerModel.count() && mActiveReplyMessages.contains("assistant"))
+            if (chatId == mCurrentChat && mAutoAnswerModel.count() && stream->messages.contains("assistant") &&
+                stream->reply->error() != QNetworkReply::OperationCanceledError)
             {
-                const auto msg = mActiveReplyMessages.value("assistant");
-                const auto content = msg->content;
-                QTimer::singleShot(500, this, [this, model, content, isAutoSend](){
+                const auto msg = stream->messages.value("assistant");
+                const auto content = msg->content.toString();
+                QTimer::singleShot(500, this, [this, chatId, model, content, isAutoSend](){
+                    if (chatId != mCurrentChat)
+                        return;
                     if (isAutoSend)
                         sendPrompt(model, content, false, false);
                     else
@@ -196,39 +934,393 @@ void ChatSession::sendPrompt(const QString &model, const QString &prompt, bool h
                 });
             }
 
-            for (const auto &msg: mActiveReplyMessages)
-                store(msg);
+            if (!stream->cached)
+            {
+                stream->stats.timeToFirstByte = stream->firstByte;
+                stream->stats.timeToFirstToken = stream->firstToken;
+            }
+
+            // Only complete answers are worth replaying
+            if (stream->cacheKey.count() && !stream->cached && stream->reply->error() == QNetworkReply::NoError && stream->raw.count())
+                storeResponse(stream->cacheKey, model, stream->raw);
+
+            for (const auto &msg: std::as_const(stream->messages))
+            {
+                msg->stats = stream->stats;
+                store(msg, chatId);
+                if (chatId == mCurrentChat)
+                    Q_EMIT messageChanged(msg);
+            }
+        }
+
+        Q_EMIT streamFinished(chatId);
+        Q_EMIT streamingChanged(chatId);
+    });
+
+    Q_EMIT streamingChanged(chatId);
+}
+
+void ChatSession::storeResponse(const QByteArray &key, const QString &model, const QByteArray &data)
+{
+    const auto limit = mResponseCacheLimit;
+    mModel->storage()->write([key, model, data, limit](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("INSERT OR REPLACE INTO response_cache (key, model, data, size, used_at) VALUES (:key, :model, :data, :size, :used_at)");
+        q.bindValue(":key", key);
+        q.bindValue(":model", model);
+        q.bindValue(":data", data);
+        q.bindValue(":size", data.size());
+        q.bindValue(":used_at", QDateTime::currentMSecsSinceEpoch());
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return;
+        }
 
-            mActiveReplyMessages.clear();
-            mActiveReply = nullptr;
-            Q_EMIT messagesChanged();
+        if (!q.exec("SELECT SUM(size) FROM response_cache") || !q.next())
+            return;
+
+        // Least recently used answers go first until the cache fits again
+        auto total = q.value(0).toLongLong();
+        if (total <= limit)
+            return;
+
+        QVariantList keys;
+        q.exec("SELECT key, size FROM response_cache ORDER BY used_at");
+        while (total > limit && q.next())
+        {
+            keys << q.value(0);
+            total -= q.value(1).toLongLong();
         }
+
+        q.prepare("DELETE FROM response_cache WHERE key = :key");
+        q.bindValue(":key", keys);
+        if (!q.execBatch())
+            qDebug() << q.lastError();
     });
+}
 
-    Q_EMIT messagesChanged();
+void ChatSession::recordPromptStats(const StreamPtr &stream, const NdjsonReader::Chunk &chunk)
+{
+    // Ollama only reports the prompt tokens it had to evaluate, so the
+    // prompt size comes from the local estimate of the sent window.
+    PromptStats stats;
+    stats.evaluatedTokens = chunk.promptEvalCount;
+    stats.promptTokens = qMax<qint64>(stream->promptTokens, chunk.promptEvalCount);
+    stats.evalDuration = chunk.promptEvalDuration / 1000000;
+    stats.timeToFirstToken = stream->firstToken;
+    if (stats.evaluatedTokens > 0)
+        stats.savedTime = (stats.promptTokens - stats.evaluatedTokens) * stats.evalDuration / stats.evaluatedTokens;
+
+    mPromptStats << stats;
+    while (mPromptStats.count() > 100)
+        mPromptStats.removeFirst();
+
+    mPromptStatsTotal.promptTokens += stats.promptTokens;
+    mPromptStatsTotal.evaluatedTokens += stats.evaluatedTokens;
+    mPromptStatsTotal.evalDuration += stats.evalDuration;
+    mPromptStatsTotal.timeToFirstToken += stats.timeToFirstToken;
+    mPromptStatsTotal.savedTime += stats.savedTime;
+
+    Q_EMIT promptStatsChanged();
 }
 
-void ChatSession::store(const MessagePtr &msg)
+QList<ChatSession::PromptStats> ChatSession::promptStats() const
 {
-    mModel->dbBegin();
+    return mPromptStats;
+}
 
-    auto db = QSqlDatabase::database(mModel->dbConnection());
-    QSqlQuery q(db);
-    q.prepare(msg->id? "INSERT OR REPLACE INTO messages (id, model, role, chat_id, content, datetime) VALUES (:id, :model, :role, :chat_id, :content, :datetime)"
-                   : "INSERT OR REPLACE INTO messages (model, role, chat_id, content, datetime) VALUES (:model, :role, :chat_id, :content, :datetime)");
-    q.bindValue(":id", msg->id);
-    q.bindValue(":model", msg->model);
-    q.bindValue(":role", msg->role);
-    q.bindValue(":chat_id", mCurrentChat);
-    q.bindValue(":content", msg->content);
-    q.bindValue(":datetime", msg->datetime.toMSecsSinceEpoch());
-    if (!q.exec())
+ChatSession::PromptStats ChatSession::promptStatsTotal() const
+{
+    return mPromptStatsTotal;
+}
+
+bool ChatSession::isStreaming(qint32 chatId) const
+{
+    return mStreams.contains(chatId);
+}
+
+bool ChatSession::isStreaming(const MessagePtr &msg) const
+{
+    for (const auto &stream: mStreams)
+        for (const auto &m: stream->messages)
+            if (m == msg)
+                return true;
+    return false;
+}
+
+QList<qint32> ChatSession::streamingChats() const
+{
+    return mStreams.keys();
+}
+
+Qt::LayoutDirection ChatSession::directionOf(const MessagePtr &msg)
+{
+    // Latin letters and digits count as left to right, nothing else in the
+    // ASCII range has a strong direction.
+    static const auto asciiLtr = [](){
+        std::array<quint8, 128> res{};
+        for (int c=0; c<128; c++)
+            res[c] = ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'));
+        return res;
+    }();
+
+    auto &dir = msg->direction;
+    const auto &content = msg->content;
+
+    // Content only grows while streaming, so the counters are kept on the
+    // message and only the bytes added since the last call are read. Any
+    // other change, like the answer moving into the reasoning, starts over.
+    if (dir.revision != content.revision() || dir.scanned > content.size())
     {
-        qDebug() << q.lastError();
+        dir = Direction();
+        dir.revision = content.revision();
+    }
+
+    qint64 base = 0;
+    for (const auto &chunk: content.chunks())
+    {
+        const auto data = reinterpret_cast<const uchar*>(chunk.constData());
+        const qint64 size = chunk.size();
+        if (base + size <= dir.scanned)
+        {
+            base += size;
+            continue;
+        }
+
+        auto i = dir.scanned - base;
+        while (i < size)
+        {
+            // Eight bytes are checked at once for pure ASCII runs, which
+            // skips decoding and the Unicode property lookups for most of
+            // the text.
+            if (i + 8 <= size)
+            {
+                quint64 word;
+                std::memcpy(&word, data + i, sizeof(word));
+                if ((word & Q_UINT64_C(0x8080808080808080)) == 0)
+                {
+                    for (int j=0; j<8; j++)
+                        dir.ltr += asciiLtr[data[i+j]];
+                    i += 8;
+                    continue;
+                }
+            }
+
+            const auto lead = data[i++];
+            if (lead < 0x80)
+            {
+                dir.ltr += asciiLtr[lead];
+                continue;
+            }
+
+            // Chunks hold whole characters, a sequence never crosses them
+            uint ch = 0;
+            qint64 len = 0;
+            if ((lead & 0xe0) == 0xc0)
+            {
+                ch = lead & 0x1f;
+                len = 1;
+            }
+            else if ((lead & 0xf0) == 0xe0)
+            {
+                ch = lead & 0x0f;
+                len = 2;
+            }
+            else
+            {
+                ch = lead & 0x07;
+                len = 3;
+            }
+            for (; len > 0 && i < size; len--)
+                ch = (ch << 6) | (data[i++] & 0x3f);
+
+            switch (static_cast<int>(QChar::direction(ch)))
+            {
+            case QChar::DirL:
+            case QChar::DirLRE:
+            case QChar::DirLRO:
+            case QChar::DirEN:
+                dir.ltr++;
+                break;
+
+            case QChar::DirR:
+            case QChar::DirRLE:
+            case QChar::DirRLO:
+            case QChar::DirAL:
+                dir.rtl++;
+                break;
+            }
+        }
+        base += size;
+    }
+    dir.scanned = content.size();
+
+    if( dir.ltr >= dir.rtl * 3 )
+        return Qt::LeftToRight;
+    else
+        return Qt::RightToLeft;
+}
+
+void ChatSession::stopStream(qint32 chatId, bool discard)
+{
+    const auto stream = mStreams.take(chatId);
+    if (!stream)
         return;
+
+    stream->discarded = discard;
+    stream->reply->abort();
+}
+
+void ChatSession::checkpoint()
+{
+    // Answers are saved while they stream, so a crash or a closed window
+    // loses at most one interval. The rows stay marked as partial until
+    // the stream finishes and stores the final message over them.
+    for (const auto &stream: std::as_const(mStreams))
+    {
+        if (!stream->dirty || stream->discarded)
+            continue;
+
+        stream->dirty = false;
+        for (const auto &msg: std::as_const(stream->messages))
+            store(msg, stream->chatId, true);
     }
+}
 
-    msg->id = q.lastInsertId().toInt();
+void ChatSession::compact(qint32 chatId, const QString &model, const QList<MessagePtr> &messages)
+{
+    if (mCompacting.contains(chatId))
+        return;
+
+    const auto summary = (chatId == mCurrentChat? mSummary : Summary());
+
+    QString transcript;
+    if (summary.text.count())
+        transcript += QStringLiteral("Earlier summary:\n") + summary.text + QStringLiteral("\n\n");
+    for (const auto &msg: messages)
+        if (msg->id > summary.upTo)
+            transcript += roleName(msg->role) + QStringLiteral(": ") + msg->content.toString() + QStringLiteral("\n\n");
+
+    const auto upTo = messages.last()->id;
+    if (upTo <= 0)
+        return;
+
+    QNetworkRequest req;
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    req.setUrl(QUrl(mBaseUrl + "/chat"));
+
+    QJsonObject system;
+    system["role"] = "system";
+    system["content"] = "Summarize the following conversation in a few short paragraphs. Keep names, facts, decisions and open questions. Answer with the summary only.";
+
+    QJsonObject user;
+    user["role"] = "user";
+    user["content"] = transcript;
+
+    QJsonObject obj;
+    obj["model"] = model;
+    obj["messages"] = QJsonArray({system, user});
+    obj["options"] = QJsonObject({{"num_ctx", mContext->budget(model)}});
+    obj["stream"] = false;
+
+    mCompacting.insert(chatId);
+
+    NetworkService::instance()->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact), this, [this, chatId, upTo](const QByteArray &data, QNetworkReply::NetworkError){
+        mCompacting.remove(chatId);
+
+        const auto json = QJsonDocument::fromJson(data);
+        QString text;
+        QString reasoning;
+        ThinkSplitter::split(json.object().value("message").toObject().value("content").toString(), text, reasoning);
+        if (text.isEmpty())
+        {
+            qDebug() << "invalid data:" << data;
+            return;
+        }
+
+        mModel->storage()->write([chatId, upTo, text](QSqlDatabase &db){
+            QSqlQuery q(db);
+            q.prepare("INSERT OR REPLACE INTO chat_summaries (chat_id, message_id, content) VALUES (:chat_id, :message_id, :content)");
+            q.bindValue(":chat_id", chatId);
+            q.bindValue(":message_id", upTo);
+            q.bindValue(":content", text);
+            if (!q.exec())
+                qDebug() << q.lastError();
+        });
+
+        if (chatId == mCurrentChat)
+            reloadSummary();
+        else
+            invalidateCache(chatId);
+    }, NetworkService::Background);
+}
+
+void ChatSession::store(const MessagePtr &msg, qint32 chatId, bool partial)
+{
+    if (!msg->id)
+    {
+        msg->id = mModel->storage()->nextMessageId();
+        mModel->touch(chatId);
+    }
+
+    // Chats in the background only change through streams finishing or
+    // being checkpointed, their cached page is loaded again when shown
+    if (chatId != mCurrentChat)
+        invalidateCache(chatId);
+
+    // The storage thread works on a copy, the message itself keeps
+    // changing on this thread. Checkpoints of a streaming answer update
+    // the same row in place, they land in the running group commit.
+    auto m = *msg;
+    m.partial = partial;
+    const auto model = ModelNames::name(m.model);
+    mModel->storage()->write([m, chatId, model](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("INSERT OR IGNORE INTO models (name) VALUES (:name)");
+        q.bindValue(":name", model);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return;
+        }
+
+        q.prepare("INSERT INTO messages (id, model_id, role, chat_id, content, reasoning, datetime, partial) "
+                  "VALUES (:id, (SELECT id FROM models WHERE name = :model), :role, :chat_id, :content, :reasoning, :datetime, :partial) "
+                  "ON CONFLICT(id) DO UPDATE SET content=excluded.content, reasoning=excluded.reasoning, partial=excluded.partial");
+        q.bindValue(":id", m.id);
+        q.bindValue(":model", model);
+        q.bindValue(":role", int(m.role));
+        q.bindValue(":chat_id", chatId);
+        q.bindValue(":content", m.content.toString());
+        q.bindValue(":reasoning", m.reasoning);
+        q.bindValue(":datetime", m.datetime.toMSecsSinceEpoch());
+        q.bindValue(":partial", m.partial);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return;
+        }
+
+        if (m.partial || !m.stats.isValid())
+            return;
+
+        q.prepare("INSERT OR REPLACE INTO message_stats (message_id, total_duration, load_duration, prompt_eval_count, prompt_eval_duration, "
+                  "eval_count, eval_duration, time_to_first_byte, time_to_first_token) "
+                  "VALUES (:message_id, :total_duration, :load_duration, :prompt_eval_count, :prompt_eval_duration, "
+                  ":eval_count, :eval_duration, :time_to_first_byte, :time_to_first_token)");
+        q.bindValue(":message_id", m.id);
+        q.bindValue(":total_duration", m.stats.totalDuration);
+        q.bindValue(":load_duration", m.stats.loadDuration);
+        q.bindValue(":prompt_eval_count", m.stats.promptEvalCount);
+        q.bindValue(":prompt_eval_duration", m.stats.promptEvalDuration);
+        q.bindValue(":eval_count", m.stats.evalCount);
+        q.bindValue(":eval_duration", m.stats.evalDuration);
+        q.bindValue(":time_to_first_byte", m.stats.timeToFirstByte);
+        q.bindValue(":time_to_first_token", m.stats.timeToFirstToken);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
 }
 
 QString ChatSession::autoAnswerModel() const
@@ -246,21 +1338,79 @@ void ChatSession::setAutoAnswerModel(const QString &newAutoAnswerModel)
 
 bool ChatSession::deleteMessage(MessagePtr msg)
 {
-    mModel->dbBegin();
-
-    auto db = QSqlDatabase::database(mModel->dbConnection());
-    QSqlQuery q(db);
-    q.prepare("DELETE FROM messages WHERE id = :id");
-    q.bindValue(":id", msg->id);
-    if (!q.exec())
+    if (msg->id)
     {
-        qDebug() << q.lastError();
-        return false;
+        const auto id = msg->id;
+        mModel->storage()->write([id](QSqlDatabase &db){
+            QSqlQuery q(db);
+            q.prepare("DELETE FROM messages WHERE id = :id");
+            q.bindValue(":id", id);
+            if (!q.exec())
+                qDebug() << q.lastError();
+        });
     }
-    reload();
+
+    if (mMessages.removeOne(msg))
+        Q_EMIT messageRemoved(msg);
     return true;
 }
 
+bool ChatSession::deterministic() const
+{
+    return mDeterministic;
+}
+
+void ChatSession::setDeterministic(bool enabled)
+{
+    mDeterministic = enabled;
+}
+
+void ChatSession::setSeed(qint32 seed)
+{
+    mSeed = seed;
+}
+
+bool ChatSession::responseCache() const
+{
+    return mResponseCache;
+}
+
+void ChatSession::setResponseCache(bool enabled)
+{
+    if (mResponseCache == enabled)
+        return;
+    mResponseCache = enabled;
+    Q_EMIT responseCacheChanged();
+}
+
+void ChatSession::setResponseCacheLimit(qint64 bytes)
+{
+    mResponseCacheLimit = bytes;
+}
+
+qint64 ChatSession::cacheHits() const
+{
+    return mCacheHits;
+}
+
+qint64 ChatSession::cacheMisses() const
+{
+    return mCacheMisses;
+}
+
+QString ChatSession::keepAlive() const
+{
+    return mKeepAlive;
+}
+
+void ChatSession::setKeepAlive(const QString &newKeepAlive)
+{
+    if (mKeepAlive == newKeepAlive)
+        return;
+    mKeepAlive = newKeepAlive;
+    Q_EMIT keepAliveChanged();
+}
+
 QString ChatSession::baseUrl() const
 {
     return mBaseUrl;
@@ -278,3 +1428,18 @@ QList<ChatSession::MessagePtr> ChatSession::messages() const
 {
     return mMessages;
 }
+
+ContextManager *ChatSession::contextManager() const
+{
+    return mContext;
+}
+
+DocumentIndex *ChatSession::documentIndex() const
+{
+    return mDocuments;
+}
+
+void ChatSession::setDocumentIndex(DocumentIndex *index)
+{
+    mDocuments = index;
+}
@@ -2,28 +2,86 @@
 #define CHATSESSION_H
 
 #include <QObject>
-#include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QSet>
+#include <QElapsedTimer>
+
+#include <functional>
 
 #include "chatsmodel.h"
+#include "ndjsonreader.h"
+#include "thinksplitter.h"
+#include "textrope.h"
+
+class ContextManager;
+class DocumentIndex;
+class QTimer;
 
 class ChatSession : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(qint32 currentChat READ currentChat WRITE setCurrentChat NOTIFY currentChatChanged FINAL)
     Q_PROPERTY(QString baseUrl READ baseUrl WRITE setBaseUrl NOTIFY baseUrlChanged FINAL)
+    Q_PROPERTY(QString keepAlive READ keepAlive WRITE setKeepAlive NOTIFY keepAliveChanged FINAL)
     Q_PROPERTY(QString autoAnswerModel READ autoAnswerModel WRITE setAutoAnswerModel NOTIFY autoAnswerModelChanged FINAL)
+    Q_PROPERTY(bool responseCache READ responseCache WRITE setResponseCache NOTIFY responseCacheChanged FINAL)
 
 public:
+    struct Stats {
+        qint64 totalDuration = 0;
+        qint64 loadDuration = 0;
+        qint64 promptEvalCount = 0;
+        qint64 promptEvalDuration = 0;
+        qint64 evalCount = 0;
+        qint64 evalDuration = 0;
+        qint64 timeToFirstByte = -1;
+        qint64 timeToFirstToken = -1;
+
+        bool isValid() const { return totalDuration > 0 || timeToFirstToken >= 0; }
+    };
+
+    struct Direction {
+        qint32 ltr = 0;
+        qint32 rtl = 0;
+        qint64 scanned = 0;
+        quint32 revision = 0;
+    };
+
+    // Stored as numbers, the order must not change
+    enum Role : quint8 {
+        User,
+        Assistant,
+        System,
+        Tool
+    };
+
     struct Message {
         qint32 id = 0;
-        QString model;
-        QString role;
-        QString content;
+        qint32 model = 0; // see ModelNames
+        Role role = User;
+        TextRope content;
+        QString reasoning;
         QDateTime datetime;
+        qint32 tokens = -1;
+        bool partial = false;
+        Direction direction;
+        Stats stats;
+
+        // Encoded JSON of the message as last sent
+        QByteArray json;
+        Role jsonRole = User;
+        qint64 jsonLength = -1;
     };
     typedef QSharedPointer<Message> MessagePtr;
 
+    struct PromptStats {
+        qint64 promptTokens = 0;
+        qint64 evaluatedTokens = 0;
+        qint64 evalDuration = 0;
+        qint64 timeToFirstToken = 0;
+        qint64 savedTime = 0;
+    };
+
     ChatSession(ChatsModel *model, QObject *parent = nullptr);
     virtual ~ChatSession();
 
@@ -32,41 +90,205 @@ public:
 
     QList<MessagePtr> messages() const;
 
+    ContextManager *contextManager() const;
+
+    DocumentIndex *documentIndex() const;
+    void setDocumentIndex(DocumentIndex *index);
+
+    QList<PromptStats> promptStats() const;
+    PromptStats promptStatsTotal() const;
+
     QString baseUrl() const;
     void setBaseUrl(const QString &newBaseUrl);
 
+    QString keepAlive() const;
+    void setKeepAlive(const QString &newKeepAlive);
+
     QString autoAnswerModel() const;
     void setAutoAnswerModel(const QString &newAutoAnswerModel);
 
+    // Sends a fixed seed and temperature 0 with every request
+    bool deterministic() const;
+    void setDeterministic(bool enabled);
+    void setSeed(qint32 seed);
+
+    // Answers of deterministic requests are kept to be replayed for the
+    // same request. Other requests are never cached.
+    bool responseCache() const;
+    void setResponseCache(bool enabled);
+    void setResponseCacheLimit(qint64 bytes);
+
+    qint64 cacheHits() const;
+    qint64 cacheMisses() const;
+
     bool deleteMessage(MessagePtr ptr);
 
+    bool hasOlder() const;
+    bool hasNewer() const;
+
+    bool isStreaming(qint32 chatId) const;
+    bool isStreaming(const MessagePtr &msg) const;
+    QList<qint32> streamingChats() const;
+
+    static Qt::LayoutDirection directionOf(const MessagePtr &msg);
+
+    static Role roleFromName(const QString &name);
+    static QString roleName(Role role);
+
 public Q_SLOTS:
     void reload();
+    void fetchOlder();
+    void fetchNewer();
+    void jumpTo(qint32 chatId, qint32 messageId);
+    void prefetch(qint32 chatId);
     void sendPrompt(const QString &model, const QString &prompt);
+    void stopStream(qint32 chatId, bool discard = false);
+    void checkpoint();
 
 Q_SIGNALS:
     void currentChatChanged();
     void messagesChanged();
+    void messagesPrepended(qint32 count);
+    void messagesAppended(qint32 count);
+    void messageFocused(const ChatSession::MessagePtr &msg);
+    void messageInserted(const ChatSession::MessagePtr &msg);
+    void messageAppended(const ChatSession::MessagePtr &msg, const QString &delta);
+    void messageRemoved(const ChatSession::MessagePtr &msg);
+    void messageChanged(const ChatSession::MessagePtr &msg);
+    void streamFinished(qint32 chatId);
+    void streamingChanged(qint32 chatId);
     void baseUrlChanged();
+    void keepAliveChanged();
+    void promptStatsChanged();
     void autoAnswerModelChanged();
+    void responseCacheChanged();
+    void cacheStatsChanged();
 
 protected:
-    void store(const MessagePtr &ptr);
+    void load(qint32 aroundId);
+    void appendStreaming();
+    void cacheCurrent();
+    void invalidateCache(qint32 chatId);
+    void store(const MessagePtr &ptr, qint32 chatId, bool partial = false);
+    void reloadSummary();
+    void loadHistory(qint32 chatId, const QString &model, const std::function<void(const QList<MessagePtr>&)> &callback);
+    void compact(qint32 chatId, const QString &model, const QList<MessagePtr> &messages);
     void sendPrompt(const QString &model, const QString &prompt, bool human, bool isAutoSend);
+    void post(qint32 chatId, const QString &model, const MessagePtr &promptMsg, const QList<MessagePtr> &history, const MessagePtr &documents, bool human, bool isAutoSend);
+    void startStream(qint32 chatId, const QString &model, const QNetworkRequest &req, const QByteArray &body, qint32 promptTokens, bool isAutoSend,
+                     const QByteArray &cacheKey, const QByteArray &cached);
+    QByteArray encodeRequest(qint32 chatId, const QString &model, const QList<MessagePtr> &messages, bool human);
+    static Role roleOf(const MessagePtr &msg, bool human);
+    static const QByteArray &encodeMessage(const MessagePtr &msg, Role role);
+    void storeResponse(const QByteArray &key, const QString &model, const QByteArray &data);
 
 private:
     ChatsModel *mModel;
 
     qint32 mCurrentChat = 0;
     QString mBaseUrl;
+    QString mKeepAlive;
 
     QString mAutoAnswerModel;
 
-    QNetworkAccessManager *mAm;
-    QNetworkReply *mActiveReply = nullptr;
-    QHash<QString, MessagePtr> mActiveReplyMessages;
+    bool mDeterministic = false;
+    qint32 mSeed = 0;
+    bool mResponseCache = false;
+    qint64 mResponseCacheLimit = 0;
+    qint64 mCacheHits = 0;
+    qint64 mCacheMisses = 0;
+
+    struct Stream {
+        qint32 chatId = 0;
+        QNetworkReply *reply = nullptr;
+        NdjsonReader reader;
+        QHash<QString, MessagePtr> messages;
+        QHash<QString, ThinkSplitter> splitters;
+        bool discarded = false;
+        bool dirty = false;
+        bool cached = false;
+        QByteArray cacheKey;
+        QByteArray raw;
+        qint32 promptTokens = 0;
+        QElapsedTimer timer;
+        qint64 firstByte = -1;
+        qint64 firstToken = -1;
+        Stats stats;
+    };
+    typedef QSharedPointer<Stream> StreamPtr;
+
+    void recordPromptStats(const StreamPtr &stream, const NdjsonReader::Chunk &chunk);
+
+    struct SentMessage {
+        qint32 id = 0;
+        qint64 length = 0;
+        Role role = User;
+        qint32 end = 0;
+    };
+
+    struct Request {
+        QByteArray head;
+        QByteArray body;
+        QList<SentMessage> sent;
+        qint32 keyEnd = 0;
+    };
+
+    QHash<qint32, StreamPtr> mStreams;
+    // Most recently sent chat first, the oldest one is evicted
+    QHash<qint32, Request> mRequests;
+    QList<qint32> mRequestsOrder;
+    QTimer *mCheckpointTimer;
+
+    struct Summary {
+        qint32 upTo = 0;
+        QString text;
+        MessagePtr message;
+    };
+
+    struct Page {
+        QList<MessagePtr> messages;
+        bool hasMore = false;
+    };
+
+    struct Snapshot {
+        QList<MessagePtr> messages;
+        MessagePtr first;
+        bool hasOlder = false;
+        bool hasNewer = false;
+        Summary summary;
+        qint64 size = 0;
+    };
+
+    void insertCache(qint32 chatId, Snapshot snapshot);
+    static Snapshot loadSnapshot(QSqlDatabase &db, qint32 chatId, qint32 aroundId);
+
+    void prependPage(qint32 beforeId, const Page &page);
+    static QList<MessagePtr> loadMessages(QSqlDatabase &db, qint32 chatId, qint32 fromId, qint32 limit, bool *hasMore = nullptr, bool newer = false);
+    static Summary loadSummary(QSqlDatabase &db, qint32 chatId);
+
+    ContextManager *mContext;
+    DocumentIndex *mDocuments = nullptr;
+    Summary mSummary;
+    QSet<qint32> mCompacting;
+
+    QList<PromptStats> mPromptStats;
+    PromptStats mPromptStatsTotal;
 
     QList<MessagePtr> mMessages;
+    MessagePtr mFirstMessage;
+    bool mHasOlder = false;
+    bool mHasNewer = false;
+    bool mFetching = false;
+    bool mLoading = false;
+    qint32 mReloadSerial = 0;
+
+    // Recently shown and prefetched chats, most recent first. Only the
+    // newest page of a chat is kept, within a memory budget.
+    QHash<qint32, Snapshot> mChatCache;
+    QList<qint32> mChatCacheOrder;
+    qint64 mChatCacheSize = 0;
+    QHash<qint32, qint32> mChatEpochs;
+    QSet<qint32> mPrefetching;
 };
 
 #endif // CHATSESSION_H
@@ -1,25 +1,23 @@
 #include "chatsmodel.h"
 
-#include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
-#include <QSqlRecord>
-#include <QCryptographicHash>
 #include <QDebug>
-#include <QIcon>
+#include <QFont>
+
+#include <limits>
+
+#define CHATS_PAGE_SIZE 200
 
 ChatsModel::ChatsModel(QObject *parent)
     : QAbstractItemModel{parent}
 {
-    mDbCommitTimer = new QTimer(this);
-    mDbCommitTimer->setInterval(300);
-
-    connect(mDbCommitTimer, &QTimer::timeout, this, &ChatsModel::dbCommit);
+    mStorage = new StorageService(this);
+    mIcon = QIcon(":/ui/icons/icon.svg");
 }
 
 ChatsModel::~ChatsModel()
 {
-    destroyDatabase();
 }
 
 int ChatsModel::rowCount(const QModelIndex &parent) const
@@ -45,7 +43,15 @@ QVariant ChatsModel::data(const QModelIndex &index, int role) const
     case Qt::DisplayRole:
         return chat->name;
     case Qt::DecorationRole:
-        return QIcon(":/ui/icons/icon.svg");
+        return mIcon;
+    case Qt::FontRole:
+        if (mStreamingChats.contains(chat->id))
+        {
+            QFont font;
+            font.setItalic(true);
+            return font;
+        }
+        break;
     }
 
     return QVariant();
@@ -58,15 +64,34 @@ QModelIndex ChatsModel::parent(const QModelIndex &index) const
 
 QModelIndex ChatsModel::index(int row, int column, const QModelIndex &parent) const
 {
-    if (row >= mChats.count())
+    if (row < 0 || row >= mChats.count())
         return QModelIndex();
 
-    return createIndex(row, column, mChatsHash.value(mChats.at(row)).data());
+    return createIndex(row, column, mChats.at(row).data());
+}
+
+bool ChatsModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && mHasMore && !mFetching;
+}
+
+void ChatsModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+
+    mFetching = true;
+    mStorage->read(this, [updatedAt = mCursorUpdatedAt, id = mCursorId](QSqlDatabase &db){
+        return loadPage(db, updatedAt, id, 0);
+    }, [this, serial = mSerial](const Page &page){
+        if (serial == mSerial)
+            appendPage(page);
+    });
 }
 
 QModelIndex ChatsModel::indexOf(qint32 chatId) const
 {
-    const auto row = mChats.indexOf(chatId);
+    const auto row = rowOf(chatId);
     if (row < 0)
         return QModelIndex();
     return index(row, 0);
@@ -80,6 +105,31 @@ qint32 ChatsModel::chatId(QModelIndex index) const
     return chat->id;
 }
 
+bool ChatsModel::exists(qint32 chatId) const
+{
+    return chatId > mClearedUpTo && !mRemoved.contains(chatId);
+}
+
+bool ChatsModel::streaming(qint32 chatId) const
+{
+    return mStreamingChats.contains(chatId);
+}
+
+void ChatsModel::setStreaming(qint32 chatId, bool streaming)
+{
+    if (mStreamingChats.contains(chatId) == streaming)
+        return;
+
+    if (streaming)
+        mStreamingChats.insert(chatId);
+    else
+        mStreamingChats.remove(chatId);
+
+    const auto idx = indexOf(chatId);
+    if (idx.isValid())
+        Q_EMIT dataChanged(idx, idx, {Qt::FontRole});
+}
+
 QString ChatsModel::fileLocation() const
 {
     return mFileLocation;
@@ -91,264 +141,322 @@ void ChatsModel::setFileLocation(const QString &newFileLocation)
         return;
 
     mFileLocation = newFileLocation;
-
-    if (mDbConnection.size())
-        destroyDatabase();
-
-    mDbConnection = mFileLocation.isEmpty()? QString() : QString::fromLatin1(QCryptographicHash::hash(mFileLocation.toUtf8(), QCryptographicHash::Sha256).toBase64());
-    if (mDbConnection.size())
-        initDatabase();
+    mStorage->open(mFileLocation);
 
     reload();
     Q_EMIT fileLocationChanged();
 }
 
-QString ChatsModel::dbConnection() const
+StorageService *ChatsModel::storage() const
 {
-    return mDbConnection;
+    return mStorage;
 }
 
-void ChatsModel::dbBegin(bool autoCommit)
+void ChatsModel::reload()
 {
-    if (mDbConnection.isEmpty())
-        return;
-    if (mDbCommitTimer->isActive())
-        return;
+    // Answers of reads started before are dropped
+    mSerial++;
+    mFetching = true;
+
+    mStorage->read(this, [](QSqlDatabase &db){
+        return loadPage(db, std::numeric_limits<qint64>::max(), std::numeric_limits<qint32>::max(), 0);
+    }, [this, serial = mSerial](const Page &page){
+        if (serial != mSerial)
+            return;
+
+        beginResetModel();
+        mChats.clear();
+        mSeqs.clear();
+        mFirstSeq = 0;
+        mHasMore = false;
+        endResetModel();
+
+        appendPage(page);
+    });
+}
 
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("BEGIN");
-    q.exec();
+qint32 ChatsModel::create(const QString &name)
+{
+    auto c = ChatPtr::create();
+    c->id = mStorage->nextChatId();
+    c->name = name;
+    c->datetime = QDateTime::currentDateTime();
+    c->updatedAt = c->datetime.toMSecsSinceEpoch();
+
+    // The insert is queued before anything written into the chat
+    mStorage->write([id = c->id, name = c->name, datetime = c->updatedAt](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("INSERT OR REPLACE INTO chats (id, name, datetime, updated_at) VALUES (:id, :name, :datetime, :updated_at)");
+        q.bindValue(":id", id);
+        q.bindValue(":name", name);
+        q.bindValue(":datetime", datetime);
+        q.bindValue(":updated_at", datetime);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
+
+    prependChat(c);
 
-    mDbCommitTimer->start();
+    return c->id;
 }
 
-void ChatsModel::dbCommit()
+void ChatsModel::remove(qint32 chatId)
 {
-    if (mDbConnection.isEmpty())
-        return;
-    if (!mDbCommitTimer->isActive())
-        return;
+    mStorage->write([chatId](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("DELETE FROM chats WHERE id=:id");
+        q.bindValue(":id", chatId);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
 
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("COMMIT");
-    q.exec();
+    mRemoved.insert(chatId);
+
+    const auto row = rowOf(chatId);
+    if (row < 0)
+        return;
 
-    mDbCommitTimer->stop();
+    beginRemoveRows(QModelIndex(), row, row);
+    takeRow(row);
+    endRemoveRows();
 }
 
-void ChatsModel::reload()
+void ChatsModel::clear()
 {
-    beginResetModel();
-    mChats.clear();
-    mChatsHash.clear();
+    mStorage->write([](QSqlDatabase &db){
+        QSqlQuery q(db);
+        if (!q.exec("DELETE FROM chats"))
+            qDebug() << q.lastError();
+    });
 
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("SELECT * FROM chats");
-    if (q.exec())
-    {
-        while (q.next())
-        {
-            const auto r = q.record();
-            auto c = ChatPtr::create();
-            c->id = r.value("id").toInt();
-            c->name = r.value("name").toString();
-            c->datetime = QDateTime::fromMSecsSinceEpoch(r.value("datetime").toLongLong());
-
-            mChats.prepend(c->id);
-            mChatsHash[c->id] = c;
-        }
-    }
-    else
-        qDebug() << q.lastError();
+    // Every chat created so far is gone, including the unloaded ones
+    mClearedUpTo = mStorage->nextChatId();
+    mRemoved.clear();
+    mSerial++;
+    mFetching = false;
+    mRevealing = 0;
 
+    beginResetModel();
+    mChats.clear();
+    mSeqs.clear();
+    mFirstSeq = 0;
+    mHasMore = false;
     endResetModel();
 }
 
-qint32 ChatsModel::create(const QString &name)
+void ChatsModel::touch(qint32 chatId)
 {
-    dbBegin();
-
-    auto c = ChatPtr::create();
-    c->name = name;
-    c->datetime = QDateTime::currentDateTime();
+    if (!exists(chatId))
+        return;
 
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("INSERT OR REPLACE INTO chats (name, datetime) VALUES (:name, :datetime)");
-    q.bindValue(":name", c->name);
-    q.bindValue(":datetime", c->datetime.toMSecsSinceEpoch());
-    if (!q.exec())
+    const auto row = rowOf(chatId);
+    if (row >= 0)
     {
-        qDebug() << q.lastError();
-        return 0;
+        const auto chat = mChats.at(row);
+        chat->updatedAt = QDateTime::currentMSecsSinceEpoch();
+        if (row == 0)
+            return;
+
+        // The rows above move down by one, the chat takes the first seq
+        beginMoveRows(QModelIndex(), row, row, QModelIndex(), 0);
+        for (qint32 i = 0; i < row; i++)
+            mSeqs[mChats.at(i)->id]++;
+        mChats.move(row, 0);
+        mSeqs[chatId] = mFirstSeq;
+        endMoveRows();
+        return;
     }
 
-    c->id = q.lastInsertId().toInt();
-
-    beginInsertRows(QModelIndex(), 0, 0);
-    mChats.prepend(c->id);
-    mChatsHash[c->id] = c;
-    endInsertRows();
-
-    return c->id;
+    // A chat further down than loaded so far comes up on its own
+    mStorage->read(this, [chatId](QSqlDatabase &db){
+        return loadChat(db, chatId);
+    }, [this, chatId, serial = mSerial](const ChatPtr &chat){
+        if (serial != mSerial || !chat || !exists(chatId) || rowOf(chatId) >= 0)
+            return;
+
+        chat->updatedAt = qMax(chat->updatedAt, QDateTime::currentMSecsSinceEpoch());
+        prependChat(chat);
+        Q_EMIT revealed(chatId);
+    });
 }
 
-void ChatsModel::remove(qint32 chatId)
+void ChatsModel::reveal(qint32 chatId)
 {
-    dbBegin();
-
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("DELETE FROM chats WHERE id=:id");
-    q.bindValue(":id", chatId);
-    if (!q.exec())
+    if (rowOf(chatId) >= 0)
     {
-        qDebug() << q.lastError();
+        Q_EMIT revealed(chatId);
         return;
     }
 
-    q.prepare("DELETE FROM messages WHERE chat_id=:id");
-    q.bindValue(":id", chatId);
-    if (!q.exec())
+    if (!exists(chatId))
+        return;
+
+    // Picked up again once the page being fetched has arrived
+    if (mFetching)
     {
-        qDebug() << q.lastError();
+        mRevealing = chatId;
         return;
     }
 
-    const auto idx = mChats.indexOf(chatId);
-    if (idx < 0)
+    if (!mHasMore)
         return;
 
-    beginRemoveRows(QModelIndex(), idx, idx);
-    mChatsHash.remove(chatId);
-    mChats.removeAt(idx);
-    endRemoveRows();
+    // Loads every page down to the chat at once, the order stays intact
+    mFetching = true;
+    mStorage->read(this, [updatedAt = mCursorUpdatedAt, id = mCursorId, chatId](QSqlDatabase &db){
+        return loadPage(db, updatedAt, id, chatId);
+    }, [this, chatId, serial = mSerial](const Page &page){
+        if (serial != mSerial)
+            return;
+
+        appendPage(page);
+        if (rowOf(chatId) >= 0)
+            Q_EMIT revealed(chatId);
+    });
 }
 
-void ChatsModel::clear()
+qint32 ChatsModel::rowOf(qint32 chatId) const
 {
-    dbBegin();
-
-    auto db = QSqlDatabase::database(mDbConnection);
-    QSqlQuery q(db);
-    q.prepare("DELETE FROM chats");
-    if (!q.exec())
-    {
-        qDebug() << q.lastError();
-        return;
-    }
+    const auto it = mSeqs.constFind(chatId);
+    if (it == mSeqs.constEnd())
+        return -1;
+    return qint32(it.value() - mFirstSeq);
+}
 
-    q.prepare("DELETE FROM messages");
-    if (!q.exec())
-    {
-        qDebug() << q.lastError();
-        return;
-    }
+void ChatsModel::prependChat(const ChatPtr &chat)
+{
+    beginInsertRows(QModelIndex(), 0, 0);
+    mFirstSeq--;
+    mChats.prepend(chat);
+    mSeqs[chat->id] = mFirstSeq;
+    endInsertRows();
+}
 
-    beginResetModel();
-    mChatsHash.clear();
-    mChats.clear();
-    endResetModel();
+void ChatsModel::takeRow(qint32 row)
+{
+    // The rows above keep their row, so their seq follows mFirstSeq
+    for (qint32 i = 0; i < row; i++)
+        mSeqs[mChats.at(i)->id]++;
+    mSeqs.remove(mChats.at(row)->id);
+    mChats.removeAt(row);
+    mFirstSeq++;
 }
 
-bool ChatsModel::initDatabase()
+void ChatsModel::appendPage(const Page &page)
 {
-    if (QSqlDatabase::contains(mDbConnection))
-        return false;
+    mFetching = false;
+    mHasMore = page.hasMore;
 
-    auto db = QSqlDatabase::addDatabase("QSQLITE", mDbConnection);
-    db.setDatabaseName(mFileLocation);
-    if (!db.open())
+    // Chats that got active meanwhile were already moved to the top
+    QList<ChatPtr> chats;
+    chats.reserve(page.chats.count());
+    for (const auto &c: page.chats)
     {
-        qDebug() << db.lastError();
-        return false;
+        if (!mSeqs.contains(c->id) && exists(c->id))
+            chats.append(c);
     }
 
-    const auto version = dbGetValue("version", "0").toInt();
-    QStringList queries;
-    switch (version)
+    if (page.chats.count())
     {
-    case 0:
-        queries << R"(CREATE TABLE "chats" (
-                      "id" INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
-                      "name" TEXT NOT NULL,
-                      "datetime" INTEGER NOT NULL
-                    ))";
-        queries << R"(CREATE TABLE "general" (
-                      "_key" TEXT NOT NULL,
-                      "_value" TEXT NOT NULL,
-                      PRIMARY KEY ("_key")
-                    ))";
-        queries << R"(CREATE TABLE "messages" (
-                      "id" INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
-                      "chat_id" INTEGER NOT NULL,
-                      "model" TEXT NOT NULL,
-                      "role" TEXT NOT NULL,
-                      "content" TEXT NOT NULL,
-                      "datetime" INTEGER NOT NULL,
-                      CONSTRAINT "messages_chat_id_frgkey" FOREIGN KEY ("chat_id") REFERENCES "chats" ("id") ON DELETE CASCADE ON UPDATE CASCADE
-                    ))";
-        break;
+        mCursorUpdatedAt = page.chats.last()->updatedAt;
+        mCursorId = page.chats.last()->id;
     }
 
-    dbBegin();
-    for (const auto &t: queries)
+    if (chats.count())
     {
-        QSqlQuery q(db);
-        q.prepare(t);
-        q.exec();
+        const auto first = mChats.count();
+        beginInsertRows(QModelIndex(), first, first + chats.count() - 1);
+        for (const auto &c: chats)
+        {
+            mSeqs[c->id] = mFirstSeq + mChats.count();
+            mChats.append(c);
+        }
+        endInsertRows();
     }
 
-    if (queries.size())
-        dbSetValue("version", "1");
-
-    return true;
+    if (mRevealing)
+    {
+        const auto chatId = mRevealing;
+        mRevealing = 0;
+        reveal(chatId);
+    }
 }
 
-void ChatsModel::destroyDatabase()
+ChatsModel::Page ChatsModel::loadPage(QSqlDatabase &db, qint64 beforeUpdatedAt, qint32 beforeId, qint32 untilChatId)
 {
-    if (mDbConnection.isEmpty())
-        return;
+    Page res;
 
-    dbCommit();
-    QSqlDatabase::database(mDbConnection).close();
-    QSqlDatabase::removeDatabase(mDbConnection);
-}
-
-QString ChatsModel::dbGetValue(const QString &key, const QString &defaultValue)
-{
-    auto db = QSqlDatabase::database(mDbConnection);
+    // Seeks along chats_updated_at_idx, the cost of a page does not
+    // depend on how far down it is
     QSqlQuery q(db);
-    q.prepare("SELECT _value FROM general WHERE _key = :key");
-    q.bindValue(":key", key);
+    q.setForwardOnly(true);
+    if (untilChatId)
+    {
+        q.prepare("SELECT c.id, c.name, c.datetime, c.updated_at FROM chats c, chats u "
+                  "WHERE u.id = :until AND (c.updated_at < :before OR (c.updated_at = :tie AND c.id < :id)) "
+                  "AND (c.updated_at > u.updated_at OR (c.updated_at = u.updated_at AND c.id >= u.id)) "
+                  "ORDER BY c.updated_at DESC, c.id DESC");
+        q.bindValue(":until", untilChatId);
+    }
+    else
+    {
+        q.prepare("SELECT id, name, datetime, updated_at FROM chats "
+                  "WHERE updated_at < :before OR (updated_at = :tie AND id < :id) "
+                  "ORDER BY updated_at DESC, id DESC LIMIT :limit");
+        q.bindValue(":limit", CHATS_PAGE_SIZE + 1);
+    }
+    q.bindValue(":before", beforeUpdatedAt);
+    q.bindValue(":tie", beforeUpdatedAt);
+    q.bindValue(":id", beforeId);
     if (!q.exec())
     {
         qDebug() << q.lastError();
-        return defaultValue;
+        return res;
     }
 
-    if (!q.next())
-        return defaultValue;
+    while (q.next())
+    {
+        auto c = ChatPtr::create();
+        c->id = q.value(0).toInt();
+        c->name = q.value(1).toString();
+        c->datetime = QDateTime::fromMSecsSinceEpoch(q.value(2).toLongLong());
+        c->updatedAt = q.value(3).toLongLong();
+        res.chats.append(c);
+    }
+
+    // One row more than a page tells whether another one follows. After
+    // loading down to a chat the next fetch finds out.
+    if (untilChatId)
+    {
+        res.hasMore = true;
+    }
+    else if (res.chats.count() > CHATS_PAGE_SIZE)
+    {
+        res.chats.removeLast();
+        res.hasMore = true;
+    }
 
-    return q.record().value(0).toString();
+    return res;
 }
 
-bool ChatsModel::dbSetValue(const QString &key, const QString &value)
+ChatsModel::ChatPtr ChatsModel::loadChat(QSqlDatabase &db, qint32 chatId)
 {
-    dbBegin();
-
-    auto db = QSqlDatabase::database(mDbConnection);
     QSqlQuery q(db);
-    q.prepare("INSERT OR REPLACE INTO general (_key, _value) VALUES (:key, :value)");
-    q.bindValue(":key", key);
-    q.bindValue(":value", value);
+    q.prepare("SELECT name, datetime, updated_at FROM chats WHERE id=:id");
+    q.bindValue(":id", chatId);
     if (!q.exec())
     {
         qDebug() << q.lastError();
-        return false;
+        return ChatPtr();
     }
-    return true;
+
+    if (!q.next())
+        return ChatPtr();
+
+    auto c = ChatPtr::create();
+    c->id = chatId;
+    c->name = q.value(0).toString();
+    c->datetime = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong());
+    c->updatedAt = q.value(2).toLongLong();
+    return c;
 }
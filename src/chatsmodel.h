@@ -3,9 +3,12 @@
 
 #include <QAbstractItemModel>
 #include <QDateTime>
+#include <QIcon>
 #include <QSharedPointer>
 #include <QTimer>
 
+#include "storageservice.h"
+
 class ChatsModel : public QAbstractItemModel
 {
     Q_OBJECT
@@ -22,48 +25,80 @@ public:
     QModelIndex parent(const QModelIndex &index) const Q_DECL_OVERRIDE;
     QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
 
+    bool canFetchMore(const QModelIndex &parent) const Q_DECL_OVERRIDE;
+    void fetchMore(const QModelIndex &parent) Q_DECL_OVERRIDE;
+
+    // Only the pages scrolled to are loaded, indexOf() is invalid for the
+    // chats after them. exists() also knows about those.
     QModelIndex indexOf(qint32 chatId) const;
     qint32 chatId(QModelIndex index) const;
+    bool exists(qint32 chatId) const;
+
+    bool streaming(qint32 chatId) const;
+    void setStreaming(qint32 chatId, bool streaming);
 
     QString fileLocation() const;
     void setFileLocation(const QString &newFileLocation);
 
-    QString dbConnection() const;
-    void dbBegin(bool autoCommit = true);
-    void dbCommit();
+    StorageService *storage() const;
 
 public Q_SLOTS:
     void reload();
     qint32 create(const QString &name);
     void remove(qint32 chatId);
     void clear();
+    void touch(qint32 chatId);
+    void reveal(qint32 chatId);
 
 Q_SIGNALS:
     void fileLocationChanged();
-
-protected:
-    bool initDatabase();
-    void destroyDatabase();
-
-    QString dbGetValue(const QString &key, const QString &defaultValue = QString());
-    bool dbSetValue(const QString &key, const QString &value);
+    void revealed(qint32 chatId);
 
 private:
     QString mFileLocation;
-    QString mDbConnection;
+    StorageService *mStorage;
 
     struct Chat
     {
         qint32 id;
         QString name;
         QDateTime datetime;
+        qint64 updatedAt = 0;
     };
     typedef QSharedPointer<Chat> ChatPtr;
 
-    QTimer *mDbCommitTimer = nullptr;
+    struct Page
+    {
+        QList<ChatPtr> chats;
+        bool hasMore = false;
+    };
 
-    QList<qint32> mChats;
-    QHash<qint32, ChatPtr> mChatsHash;
+    qint32 rowOf(qint32 chatId) const;
+    void prependChat(const ChatPtr &chat);
+    void takeRow(qint32 row);
+    void appendPage(const Page &page);
+    static Page loadPage(QSqlDatabase &db, qint64 beforeUpdatedAt, qint32 beforeId, qint32 untilChatId);
+    static ChatPtr loadChat(QSqlDatabase &db, qint32 chatId);
+
+    // Rows are numbered from mFirstSeq on, so a chat's row is found in
+    // constant time. Only the rows above a moved or removed one are
+    // renumbered, which are few as activity happens at the top.
+    QList<ChatPtr> mChats;
+    QHash<qint32, qint64> mSeqs;
+    qint64 mFirstSeq = 0;
+
+    // Keyset of the last fetched row, the next page starts after it
+    qint64 mCursorUpdatedAt = 0;
+    qint32 mCursorId = 0;
+    bool mHasMore = false;
+    bool mFetching = false;
+    qint32 mSerial = 0;
+    qint32 mRevealing = 0;
+
+    qint32 mClearedUpTo = 0;
+    QSet<qint32> mRemoved;
+    QSet<qint32> mStreamingChats;
+    QIcon mIcon;
 };
 
 #endif // CHATSMODEL_H
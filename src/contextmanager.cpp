@@ -0,0 +1,237 @@
+#include "contextmanager.h"
+
+#include <QVector>
+
+ContextManager::ContextManager(QObject *parent)
+    : QObject{parent}
+{
+}
+
+ContextManager::~ContextManager()
+{
+}
+
+qint32 ContextManager::defaultBudget() const
+{
+    return mDefaultBudget;
+}
+
+void ContextManager::setDefaultBudget(qint32 newDefaultBudget)
+{
+    if (mDefaultBudget == newDefaultBudget)
+        return;
+    mDefaultBudget = newDefaultBudget;
+    Q_EMIT defaultBudgetChanged();
+}
+
+QVariantMap ContextManager::budgets() const
+{
+    return mBudgets;
+}
+
+void ContextManager::setBudgets(const QVariantMap &newBudgets)
+{
+    if (mBudgets == newBudgets)
+        return;
+    mBudgets = newBudgets;
+    Q_EMIT budgetsChanged();
+}
+
+qint32 ContextManager::budget(const QString &model) const
+{
+    const auto res = mBudgets.value(model).toInt();
+    return res > 0? res : mDefaultBudget;
+}
+
+bool ContextManager::compaction() const
+{
+    return mCompaction;
+}
+
+void ContextManager::setCompaction(bool newCompaction)
+{
+    if (mCompaction == newCompaction)
+        return;
+    mCompaction = newCompaction;
+    Q_EMIT compactionChanged();
+}
+
+bool ContextManager::prefixStable() const
+{
+    return mPrefixStable;
+}
+
+void ContextManager::setPrefixStable(bool newPrefixStable)
+{
+    if (mPrefixStable == newPrefixStable)
+        return;
+    mPrefixStable = newPrefixStable;
+    mAnchors.clear();
+    Q_EMIT prefixStableChanged();
+}
+
+ContextManager::Window ContextManager::select(qint32 chatId, const QString &model, const QList<ChatSession::MessagePtr> &messages, const ChatSession::MessagePtr &summary, const ChatSession::MessagePtr &documents)
+{
+    Window res;
+    if (messages.isEmpty())
+        return res;
+
+    // A quarter of the context is kept free for the answer. Retrieved
+    // documents go right before the prompt and are always sent.
+    const auto summaryTokens = (mCompaction && summary)? tokensOf(summary) : 0;
+    const auto documentTokens = documents? tokensOf(documents) : 0;
+    const auto available = budget(model) * 3 / 4 - summaryTokens - documentTokens;
+    const auto last = messages.count() - 1;
+
+    QVector<bool> included(messages.count(), false);
+    const auto pin = [&](int i){
+        if (included.at(i))
+            return;
+        included[i] = true;
+        res.tokens += tokensOf(messages.at(i));
+    };
+
+    // The first message and the system messages set up the conversation,
+    // and the last one is the prompt itself. They are always sent.
+    pin(0);
+    for (int i=1; i<last; i++)
+        if (messages.at(i)->role == ChatSession::System)
+            pin(i);
+    pin(last);
+
+    // In prefix stable mode the window keeps starting at the same message as
+    // long as everything after it fits, so the server can reuse the prompt
+    // it has already evaluated. When it has to move, it moves far enough to
+    // leave room for the next turns.
+    const auto stable = (mPrefixStable && chatId);
+
+    auto anchor = -1;
+    const auto anchorId = stable? mAnchors.value(chatId) : 0;
+    for (int i=1; i<last && anchorId; i++)
+        if (messages.at(i)->id == anchorId)
+        {
+            anchor = i;
+            break;
+        }
+
+    auto start = last;
+    if (anchor > 0)
+    {
+        qint32 tokens = 0;
+        for (int i=anchor; i<last; i++)
+            if (!included.at(i))
+                tokens += tokensOf(messages.at(i));
+
+        if (res.tokens + tokens <= available)
+        {
+            for (int i=anchor; i<last; i++)
+                included[i] = true;
+            res.tokens += tokens;
+            start = anchor;
+        }
+        else
+            anchor = -1;
+    }
+
+    if (anchor <= 0)
+    {
+        // The window only shrinks to half when it has to slide, a history
+        // that still fits is sent whole
+        auto limit = available;
+        if (stable)
+        {
+            qint32 tokens = 0;
+            for (int i=1; i<last; i++)
+                if (!included.at(i))
+                    tokens += tokensOf(messages.at(i));
+            if (res.tokens + tokens > available)
+                limit = available / 2;
+        }
+
+        for (int i=last-1; i>0; i--)
+        {
+            if (!included.at(i))
+            {
+                const auto tokens = tokensOf(messages.at(i));
+                if (res.tokens + tokens > limit)
+                    break;
+
+                included[i] = true;
+                res.tokens += tokens;
+            }
+            start = i;
+        }
+
+        if (stable && start < last && messages.at(start)->id)
+            mAnchors[chatId] = messages.at(start)->id;
+        else
+            mAnchors.remove(chatId);
+    }
+
+    for (int i=1; i<start; i++)
+        if (!included.at(i))
+            res.dropped << messages.at(i);
+
+    for (int i=0; i<=last; i++)
+    {
+        if (i == start && summaryTokens && !res.dropped.isEmpty())
+        {
+            res.messages << summary;
+            res.tokens += summaryTokens;
+        }
+        if (i == last && documentTokens)
+        {
+            res.messages << documents;
+            res.tokens += documentTokens;
+        }
+        if (included.at(i))
+            res.messages << messages.at(i);
+    }
+
+    return res;
+}
+
+qint32 ContextManager::tokensOf(const ChatSession::MessagePtr &msg)
+{
+    if (msg->tokens < 0)
+        msg->tokens = estimateTokens(msg->content);
+    return msg->tokens;
+}
+
+qint32 ContextManager::estimateTokens(const QString &text)
+{
+    // Roughly four latin characters per token, while other scripts tend to
+    // take a token per one or two characters. A few tokens are added for the
+    // role and message framing of the chat template.
+    qint32 ascii = 0;
+    qint32 other = 0;
+    for (const auto &ch: text)
+    {
+        if (ch.unicode() < 0x80)
+            ascii++;
+        else
+            other++;
+    }
+
+    return 4 + (ascii + 3) / 4 + (other + 1) / 2;
+}
+
+qint32 ContextManager::estimateTokens(const TextRope &text)
+{
+    // Same estimate on UTF-8, continuation bytes are not counted
+    qint32 ascii = 0;
+    qint32 other = 0;
+    for (const auto &chunk: text.chunks())
+    {
+        for (const auto c: chunk)
+        {
+            const auto b = uchar(c);
+            if (b < 0x80)
+                ascii++;
+            else if ((b & 0xc0) != 0x80)
+                other++;
+        }
+    }
+
+    return 4 + (ascii + 3) / 4 + (other + 1) / 2;
+}
@@ -0,0 +1,61 @@
+#ifndef CONTEXTMANAGER_H
+#define CONTEXTMANAGER_H
+
+#include <QObject>
+#include <QVariantMap>
+
+#include "chatsession.h"
+
+class ContextManager : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint32 defaultBudget READ defaultBudget WRITE setDefaultBudget NOTIFY defaultBudgetChanged FINAL)
+    Q_PROPERTY(QVariantMap budgets READ budgets WRITE setBudgets NOTIFY budgetsChanged FINAL)
+    Q_PROPERTY(bool compaction READ compaction WRITE setCompaction NOTIFY compactionChanged FINAL)
+    Q_PROPERTY(bool prefixStable READ prefixStable WRITE setPrefixStable NOTIFY prefixStableChanged FINAL)
+
+public:
+    struct Window {
+        QList<ChatSession::MessagePtr> messages;
+        QList<ChatSession::MessagePtr> dropped;
+        qint32 tokens = 0;
+    };
+
+    ContextManager(QObject *parent = nullptr);
+    virtual ~ContextManager();
+
+    qint32 defaultBudget() const;
+    void setDefaultBudget(qint32 newDefaultBudget);
+
+    QVariantMap budgets() const;
+    void setBudgets(const QVariantMap &newBudgets);
+
+    qint32 budget(const QString &model) const;
+
+    bool compaction() const;
+    void setCompaction(bool newCompaction);
+
+    bool prefixStable() const;
+    void setPrefixStable(bool newPrefixStable);
+
+    Window select(qint32 chatId, const QString &model, const QList<ChatSession::MessagePtr> &messages, const ChatSession::MessagePtr &summary = ChatSession::MessagePtr(), const ChatSession::MessagePtr &documents = ChatSession::MessagePtr());
+
+    static qint32 tokensOf(const ChatSession::MessagePtr &msg);
+    static qint32 estimateTokens(const QString &text);
+    static qint32 estimateTokens(const TextRope &text);
+
+Q_SIGNALS:
+    void defaultBudgetChanged();
+    void budgetsChanged();
+    void compactionChanged();
+    void prefixStableChanged();
+
+private:
+    qint32 mDefaultBudget = 4096;
+    QVariantMap mBudgets;
+    bool mCompaction = false;
+    bool mPrefixStable = false;
+    QHash<qint32, qint32> mAnchors;
+};
+
+#endif // CONTEXTMANAGER_H
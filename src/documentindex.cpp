@@ -0,0 +1,617 @@
+#include "documentindex.h"
+#include "embeddingindex.h"
+#include "contextmanager.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSet>
+#include <QDebug>
+
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#define CHUNK_SIZE 2048
+#define BINARY_PROBE 8192
+#define EMBED_BATCH_SIZE 32
+#define RETRIEVE_CANDIDATES 16
+
+DocumentIndex::DocumentIndex(StorageService *storage, QObject *parent)
+    : QObject{parent}
+    , mStorage(storage)
+{
+
+    mThread = new QThread(this);
+    mThread->setObjectName("documents");
+
+    mWorker = new QObject;
+    mWorker->moveToThread(mThread);
+    connect(mThread, &QThread::finished, mWorker, &QObject::deleteLater);
+
+    mThread->start();
+}
+
+DocumentIndex::~DocumentIndex()
+{
+    mThread->quit();
+    mThread->wait();
+}
+
+QString DocumentIndex::model() const
+{
+    return mModel;
+}
+
+void DocumentIndex::setModel(const QString &newModel)
+{
+    if (mModel == newModel)
+        return;
+
+    // Work in flight was for the old model and is dropped
+    mModel = newModel;
+    mSerial++;
+    mFiles.clear();
+    mBusy = false;
+
+    reindex();
+    Q_EMIT modelChanged();
+}
+
+QString DocumentIndex::baseUrl() const
+{
+    return mBaseUrl;
+}
+
+void DocumentIndex::setBaseUrl(const QString &newBaseUrl)
+{
+    if (mBaseUrl == newBaseUrl)
+        return;
+
+    mBaseUrl = newBaseUrl;
+    reindex();
+    Q_EMIT baseUrlChanged();
+}
+
+bool DocumentIndex::indexing() const
+{
+    return mIndexing;
+}
+
+void DocumentIndex::setIndexing(bool indexing)
+{
+    if (mIndexing == indexing)
+        return;
+
+    mIndexing = indexing;
+    Q_EMIT indexingChanged();
+}
+
+QStringList DocumentIndex::sources(qint32 chatId) const
+{
+    return mSources.value(chatId);
+}
+
+void DocumentIndex::attach(qint32 chatId, const QString &path)
+{
+    const auto root = rootOf(path);
+    if (root.isEmpty() || mSources.value(chatId).contains(root))
+        return;
+
+    mSources[chatId] << root;
+    mStorage->write([chatId, root](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("INSERT OR IGNORE INTO chat_sources (chat_id, path) VALUES (:chat_id, :path)");
+        q.bindValue(":chat_id", chatId);
+        q.bindValue(":path", root);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
+    Q_EMIT sourcesChanged(chatId);
+
+    if (!mRoots.contains(root))
+        mRoots << root;
+    indexNext();
+}
+
+void DocumentIndex::detach(qint32 chatId, const QString &path)
+{
+    if (!mSources[chatId].removeOne(path))
+        return;
+    if (mSources.value(chatId).isEmpty())
+        mSources.remove(chatId);
+
+    mStorage->write([chatId, path](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("DELETE FROM chat_sources WHERE chat_id = :chat_id AND path = :path");
+        q.bindValue(":chat_id", chatId);
+        q.bindValue(":path", path);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
+    Q_EMIT sourcesChanged(chatId);
+}
+
+void DocumentIndex::reload()
+{
+    mStorage->read(this, [](QSqlDatabase &db){
+        QHash<qint32, QStringList> res;
+
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        if (!q.exec("SELECT chat_id, path FROM chat_sources"))
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+
+        while (q.next())
+            res[q.value(0).toInt()] << q.value(1).toString();
+
+        return res;
+    }, [this](const QHash<qint32, QStringList> &sources){
+        mSources = sources;
+        reindex();
+    });
+}
+
+void DocumentIndex::reindex()
+{
+    // Every source is walked again, only files whose size or time changed
+    // since they were indexed are read.
+    QSet<QString> roots;
+    for (const auto &paths: std::as_const(mSources))
+        for (const auto &path: paths)
+            roots.insert(path);
+
+    mRoots = roots.values();
+    indexNext();
+}
+
+void DocumentIndex::indexNext()
+{
+    if (mBusy)
+        return;
+
+    if (mModel.isEmpty() || mBaseUrl.isEmpty() || (mFiles.isEmpty() && mRoots.isEmpty()))
+    {
+        setIndexing(false);
+        return;
+    }
+
+    mBusy = true;
+    setIndexing(true);
+
+    if (!mFiles.isEmpty())
+    {
+        indexFile();
+        return;
+    }
+
+    struct Diff {
+        QList<FileInfo> changed;
+        QStringList removed;
+    };
+
+    const auto serial = mSerial;
+    const auto root = mRoots.takeFirst();
+    run(this, [root](){
+        return listFiles(root);
+    }, [this, serial, root](const QList<FileInfo> &files){
+        if (serial != mSerial)
+            return;
+
+        mStorage->read(this, [root, files, model = mModel](QSqlDatabase &db){
+            Diff res;
+
+            QHash<QString, QPair<qint64, qint64>> known;
+            QSqlQuery q(db);
+            q.setForwardOnly(true);
+            q.prepare("SELECT path, size, mtime FROM document_files WHERE model = :model AND path >= :root AND path < :root || char(0x10FFFF)");
+            q.bindValue(":model", model);
+            q.bindValue(":root", root);
+            if (!q.exec())
+            {
+                qDebug() << q.lastError();
+                return res;
+            }
+
+            while (q.next())
+                known[q.value(0).toString()] = qMakePair(q.value(1).toLongLong(), q.value(2).toLongLong());
+
+            for (const auto &f: files)
+            {
+                const auto it = known.find(f.path);
+                if (it == known.end() || it->first != f.size || it->second != f.mtime)
+                    res.changed << f;
+                if (it != known.end())
+                    known.erase(it);
+            }
+
+            res.removed = known.keys();
+            return res;
+        }, [this, serial](const Diff &diff){
+            if (serial != mSerial)
+                return;
+
+            if (!diff.removed.isEmpty())
+            {
+                mStorage->write([removed = diff.removed](QSqlDatabase &db){
+                    QSqlQuery q(db);
+                    q.prepare("DELETE FROM document_files WHERE path = :path");
+                    for (const auto &path: removed)
+                    {
+                        q.bindValue(":path", path);
+                        if (!q.exec())
+                            qDebug() << q.lastError();
+                    }
+                });
+            }
+
+            mFiles += diff.changed;
+            mBusy = false;
+            indexNext();
+        });
+    });
+}
+
+void DocumentIndex::indexFile()
+{
+    const auto serial = mSerial;
+    const auto file = mFiles.takeFirst();
+    run(this, [path = file.path](){
+        return chunkFile(path);
+    }, [this, serial, file](const QList<Chunk> &chunks){
+        if (serial != mSerial)
+            return;
+
+        // The old chunks are replaced right away, but the file only counts
+        // as indexed once all of its chunks have vectors.
+        mStorage->write([file, chunks](QSqlDatabase &db){
+            QSqlQuery q(db);
+            q.prepare("INSERT INTO document_files (path, size, mtime, model) VALUES (:path, -1, 0, '') ON CONFLICT(path) DO UPDATE SET size = -1");
+            q.bindValue(":path", file.path);
+            if (!q.exec())
+                qDebug() << q.lastError();
+
+            q.prepare("DELETE FROM document_chunks WHERE path = :path");
+            q.bindValue(":path", file.path);
+            if (!q.exec())
+                qDebug() << q.lastError();
+
+            q.prepare("INSERT INTO document_chunks (path, start, length, hash) VALUES (:path, :start, :length, :hash)");
+            for (const auto &c: chunks)
+            {
+                q.bindValue(":path", file.path);
+                q.bindValue(":start", c.offset);
+                q.bindValue(":length", c.length);
+                q.bindValue(":hash", c.hash);
+                if (!q.exec())
+                    qDebug() << q.lastError();
+            }
+        });
+
+        // Chunks are cached by content, unchanged parts of an edited file
+        // and files copied around the tree are never embedded twice.
+        mStorage->read(this, [chunks, model = mModel](QSqlDatabase &db){
+            QList<Chunk> res;
+            QSet<QByteArray> seen;
+
+            QSqlQuery q(db);
+            q.prepare("SELECT 1 FROM chunk_embeddings WHERE hash = :hash AND model = :model");
+            for (const auto &c: chunks)
+            {
+                if (seen.contains(c.hash))
+                    continue;
+                seen.insert(c.hash);
+
+                q.bindValue(":hash", c.hash);
+                q.bindValue(":model", model);
+                if (!q.exec())
+                {
+                    qDebug() << q.lastError();
+                    continue;
+                }
+                if (!q.next())
+                    res << c;
+            }
+
+            return res;
+        }, [this, serial, file](const QList<Chunk> &missing){
+            if (serial != mSerial)
+                return;
+            embedChunks(file, missing);
+        });
+    });
+}
+
+void DocumentIndex::embedChunks(const FileInfo &file, const QList<Chunk> &chunks)
+{
+    if (chunks.isEmpty())
+    {
+        finishFile(file);
+        return;
+    }
+
+    const auto serial = mSerial;
+    const auto batch = chunks.mid(0, EMBED_BATCH_SIZE);
+    const auto rest = chunks.mid(EMBED_BATCH_SIZE);
+    run(this, [path = file.path, batch](){
+        QStringList res;
+        for (const auto &c: batch)
+            res << readChunk(path, c.offset, c.length);
+        return res;
+    }, [this, serial, file, batch, rest](const QStringList &texts){
+        if (serial != mSerial)
+            return;
+
+        embed(texts, this, [this, serial, file, batch, rest, model = mModel](const QByteArray &data, QNetworkReply::NetworkError error){
+            if (serial != mSerial)
+                return;
+
+            const auto vectors = (error == QNetworkReply::NoError)? EmbeddingIndex::parseEmbeddings(data) : QList<QByteArray>();
+            if (vectors.count() != batch.count())
+            {
+                // The server is gone or can't embed with this model. What is
+                // left is picked up by the next pass.
+                qDebug() << "embedding failed for" << file.path << error;
+                mFiles.clear();
+                mRoots.clear();
+                mBusy = false;
+                setIndexing(false);
+                return;
+            }
+
+            mStorage->write([batch, vectors, model](QSqlDatabase &db){
+                QSqlQuery q(db);
+                q.prepare("INSERT OR IGNORE INTO chunk_embeddings (hash, model, vector) VALUES (:hash, :model, :vector)");
+                for (int i=0; i<batch.count(); i++)
+                {
+                    q.bindValue(":hash", batch.at(i).hash);
+                    q.bindValue(":model", model);
+                    q.bindValue(":vector", vectors.at(i));
+                    if (!q.exec())
+                        qDebug() << q.lastError();
+                }
+            });
+
+            embedChunks(file, rest);
+        }, NetworkService::Background);
+    });
+}
+
+void DocumentIndex::finishFile(const FileInfo &file)
+{
+    mStorage->write([file, model = mModel](QSqlDatabase &db){
+        QSqlQuery q(db);
+        q.prepare("UPDATE document_files SET size = :size, mtime = :mtime, model = :model WHERE path = :path");
+        q.bindValue(":size", file.size);
+        q.bindValue(":mtime", file.mtime);
+        q.bindValue(":model", model);
+        q.bindValue(":path", file.path);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    });
+
+    mBusy = false;
+    indexNext();
+}
+
+void DocumentIndex::embed(const QStringList &input, QObject *context, const NetworkService::Callback &callback, NetworkService::Priority priority)
+{
+    QNetworkRequest req;
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    req.setUrl(QUrl(mBaseUrl + "/embed"));
+
+    QJsonObject obj;
+    obj["model"] = mModel;
+    obj["input"] = QJsonArray::fromStringList(input);
+
+    NetworkService::instance()->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact), context, callback, priority);
+}
+
+void DocumentIndex::retrieve(qint32 chatId, const QString &query, qint32 budget, QObject *context, const std::function<void(const QList<Excerpt>&)> &callback)
+{
+    if (!mSources.contains(chatId) || mModel.isEmpty() || mBaseUrl.isEmpty() || budget <= 0)
+    {
+        callback(QList<Excerpt>());
+        return;
+    }
+
+    struct Candidate {
+        QString path;
+        qint64 offset = 0;
+        qint32 length = 0;
+        float score = 0;
+    };
+
+    embed({query}, context, [this, chatId, budget, context, callback, model = mModel](const QByteArray &data, QNetworkReply::NetworkError error){
+        const auto vectors = EmbeddingIndex::parseEmbeddings(data);
+        if (vectors.isEmpty())
+        {
+            qDebug() << "embedding failed:" << error;
+            callback(QList<Excerpt>());
+            return;
+        }
+
+        // The chunks are scored while they are read, only the best few are
+        // kept, so memory stays flat however large the sources are.
+        mStorage->read(context, [chatId, model, query = vectors.first()](QSqlDatabase &db){
+            const auto worse = [](const Candidate &a, const Candidate &b){ return a.score > b.score; };
+            std::priority_queue<Candidate, std::vector<Candidate>, decltype(worse)> best(worse);
+
+            QSqlQuery q(db);
+            q.setForwardOnly(true);
+            // A range on the path is served by the index, the chunks of
+            // other chats' sources are never read
+            q.prepare("SELECT c.path, c.start, c.length, e.vector FROM chat_sources s "
+                      "CROSS JOIN document_chunks c ON c.path >= s.path AND c.path < s.path || char(0x10FFFF) "
+                      "JOIN chunk_embeddings e ON e.hash = c.hash AND e.model = :model "
+                      "WHERE s.chat_id = :chat_id");
+            q.bindValue(":model", model);
+            q.bindValue(":chat_id", chatId);
+            if (!q.exec())
+                qDebug() << q.lastError();
+
+            while (q.next())
+            {
+                const auto score = EmbeddingIndex::similarity(query, q.value(3).toByteArray());
+                if (best.size() >= RETRIEVE_CANDIDATES && score <= best.top().score)
+                    continue;
+
+                Candidate c;
+                c.path = q.value(0).toString();
+                c.offset = q.value(1).toLongLong();
+                c.length = q.value(2).toInt();
+                c.score = score;
+                best.push(c);
+                if (best.size() > RETRIEVE_CANDIDATES)
+                    best.pop();
+            }
+
+            QList<Candidate> res;
+            for (; !best.empty(); best.pop())
+                res.prepend(best.top());
+            return res;
+        }, [this, budget, context, callback](const QList<Candidate> &candidates){
+            run(context, [candidates, budget](){
+                QList<Excerpt> res;
+                qint32 tokens = 0;
+                for (const auto &c: candidates)
+                {
+                    Excerpt e;
+                    e.path = c.path;
+                    e.text = readChunk(c.path, c.offset, c.length).trimmed();
+                    e.tokens = ContextManager::estimateTokens(e.text);
+                    if (e.text.isEmpty() || tokens + e.tokens > budget)
+                        continue;
+
+                    tokens += e.tokens;
+                    res << e;
+                }
+                return res;
+            }, callback);
+        });
+    });
+}
+
+QString DocumentIndex::rootOf(const QString &path)
+{
+    // Folders end with a slash, so a prefix match never picks up a sibling
+    // that only starts with the same name.
+    const QFileInfo fi(path);
+    if (!fi.exists())
+        return QString();
+
+    auto res = fi.canonicalFilePath();
+    if (fi.isDir() && !res.endsWith('/'))
+        res += '/';
+    return res;
+}
+
+QList<DocumentIndex::FileInfo> DocumentIndex::listFiles(const QString &root)
+{
+    QList<FileInfo> res;
+    const auto add = [&res](const QFileInfo &fi){
+        FileInfo f;
+        f.path = fi.filePath();
+        f.size = fi.size();
+        f.mtime = fi.lastModified().toMSecsSinceEpoch();
+        res << f;
+    };
+
+    if (!root.endsWith('/'))
+    {
+        const QFileInfo fi(root);
+        if (fi.isFile())
+            add(fi);
+        return res;
+    }
+
+    QDirIterator it(root, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        it.next();
+        add(it.fileInfo());
+    }
+
+    return res;
+}
+
+QList<DocumentIndex::Chunk> DocumentIndex::chunkFile(const QString &path)
+{
+    QList<Chunk> res;
+
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly))
+        return res;
+
+    const auto size = f.size();
+    if (size <= 0)
+        return res;
+
+    // The file is mapped instead of read, the pages are only touched once
+    // while the chunks are cut and hashed.
+    const auto data = f.map(0, size);
+    if (!data)
+        return res;
+
+    // Files with NUL bytes near the start are binary and skipped
+    if (std::memchr(data, 0, size_t(qMin<qint64>(size, BINARY_PROBE))))
+    {
+        f.unmap(data);
+        return res;
+    }
+
+    qint64 start = 0;
+    while (start < size)
+    {
+        auto end = qMin<qint64>(start + CHUNK_SIZE, size);
+        if (end < size)
+        {
+            // Cut at a line break in the second half of the chunk, or else
+            // at least not inside a UTF-8 sequence
+            auto cut = end;
+            while (cut > start + CHUNK_SIZE / 2 && data[cut - 1] != '\n')
+                cut--;
+
+            if (cut > start + CHUNK_SIZE / 2)
+                end = cut;
+            else
+                while (end > start + 1 && (data[end] & 0xC0) == 0x80)
+                    end--;
+        }
+
+        Chunk c;
+        c.offset = start;
+        c.length = qint32(end - start);
+        c.hash = QCryptographicHash::hash(QByteArray::fromRawData(reinterpret_cast<const char*>(data + start), c.length), QCryptographicHash::Sha1);
+        res << c;
+
+        start = end;
+    }
+
+    f.unmap(data);
+    return res;
+}
+
+QString DocumentIndex::readChunk(const QString &path, qint64 offset, qint32 length)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly) || length <= 0)
+        return QString();
+
+    const auto data = f.map(offset, length);
+    if (!data)
+        return QString();
+
+    const auto res = QString::fromUtf8(reinterpret_cast<const char*>(data), length);
+    f.unmap(data);
+    return res;
+}
@@ -0,0 +1,116 @@
+#ifndef DOCUMENTINDEX_H
+#define DOCUMENTINDEX_H
+
+#include <QObject>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QThread>
+#include <QHash>
+
+#include <functional>
+#include <utility>
+
+#include "storageservice.h"
+#include "networkservice.h"
+
+class DocumentIndex : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString model READ model WRITE setModel NOTIFY modelChanged FINAL)
+    Q_PROPERTY(QString baseUrl READ baseUrl WRITE setBaseUrl NOTIFY baseUrlChanged FINAL)
+    Q_PROPERTY(bool indexing READ indexing NOTIFY indexingChanged FINAL)
+
+public:
+    struct Excerpt {
+        QString path;
+        QString text;
+        qint32 tokens = 0;
+    };
+
+    DocumentIndex(StorageService *storage, QObject *parent = nullptr);
+    virtual ~DocumentIndex();
+
+    QString model() const;
+    void setModel(const QString &newModel);
+
+    QString baseUrl() const;
+    void setBaseUrl(const QString &newBaseUrl);
+
+    bool indexing() const;
+
+    QStringList sources(qint32 chatId) const;
+    void attach(qint32 chatId, const QString &path);
+    void detach(qint32 chatId, const QString &path);
+
+    // Returns the chunks of the chat's sources closest to the query, best
+    // first, cut to fit the token budget.
+    void retrieve(qint32 chatId, const QString &query, qint32 budget, QObject *context, const std::function<void(const QList<Excerpt>&)> &callback);
+
+public Q_SLOTS:
+    void reload();
+    void reindex();
+
+Q_SIGNALS:
+    void modelChanged();
+    void baseUrlChanged();
+    void indexingChanged();
+    void sourcesChanged(qint32 chatId);
+
+protected:
+    struct FileInfo {
+        QString path;
+        qint64 size = 0;
+        qint64 mtime = 0;
+    };
+
+    struct Chunk {
+        qint64 offset = 0;
+        qint32 length = 0;
+        QByteArray hash;
+    };
+
+    // File reads run on their own thread, so a large tree neither blocks
+    // the GUI nor the storage queue.
+    template<typename Func, typename Callback>
+    void run(QObject *context, Func job, Callback callback)
+    {
+        QPointer<QObject> guard(context);
+        QMetaObject::invokeMethod(mWorker, [this, guard, job, callback](){
+            auto res = job();
+            QMetaObject::invokeMethod(this, [guard, callback, res = std::move(res)](){
+                if (guard)
+                    callback(res);
+            }, Qt::QueuedConnection);
+        }, Qt::QueuedConnection);
+    }
+
+    void indexNext();
+    void indexFile();
+    void embedChunks(const FileInfo &file, const QList<Chunk> &chunks);
+    void finishFile(const FileInfo &file);
+    void setIndexing(bool indexing);
+    void embed(const QStringList &input, QObject *context, const NetworkService::Callback &callback, NetworkService::Priority priority = NetworkService::Interactive);
+
+    static QString rootOf(const QString &path);
+    static QList<FileInfo> listFiles(const QString &root);
+    static QList<Chunk> chunkFile(const QString &path);
+    static QString readChunk(const QString &path, qint64 offset, qint32 length);
+
+private:
+    StorageService *mStorage;
+    QThread *mThread;
+    QObject *mWorker;
+
+    QString mModel;
+    QString mBaseUrl;
+
+    qint32 mSerial = 0;
+    bool mIndexing = false;
+    bool mBusy = false;
+
+    QHash<qint32, QStringList> mSources;
+    QStringList mRoots;
+    QList<FileInfo> mFiles;
+};
+
+#endif // DOCUMENTINDEX_H
@@ -0,0 +1,431 @@
+#include "embeddingindex.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define EMBED_BATCH_SIZE 32
+#define EMBED_MAX_LENGTH 8000
+#define EMBED_SCHEDULE_DELAY 2000
+#define EMBED_SCALE 127
+
+EmbeddingIndex::EmbeddingIndex(StorageService *storage, QObject *parent)
+    : QObject{parent}
+    , mStorage(storage)
+{
+
+    // New answers are embedded in batches shortly after they are stored
+    mScheduleTimer = new QTimer(this);
+    mScheduleTimer->setInterval(EMBED_SCHEDULE_DELAY);
+    mScheduleTimer->setSingleShot(true);
+
+    connect(mScheduleTimer, &QTimer::timeout, this, &EmbeddingIndex::indexNext);
+}
+
+EmbeddingIndex::~EmbeddingIndex()
+{
+}
+
+QString EmbeddingIndex::model() const
+{
+    return mModel;
+}
+
+void EmbeddingIndex::setModel(const QString &newModel)
+{
+    if (mModel == newModel)
+        return;
+
+    mModel = newModel;
+    reload();
+    Q_EMIT modelChanged();
+}
+
+QString EmbeddingIndex::baseUrl() const
+{
+    return mBaseUrl;
+}
+
+void EmbeddingIndex::setBaseUrl(const QString &newBaseUrl)
+{
+    if (mBaseUrl == newBaseUrl)
+        return;
+
+    mBaseUrl = newBaseUrl;
+    schedule();
+    Q_EMIT baseUrlChanged();
+}
+
+qint32 EmbeddingIndex::count() const
+{
+    return mIds.count();
+}
+
+void EmbeddingIndex::schedule()
+{
+    if (!mScheduleTimer->isActive())
+        mScheduleTimer->start();
+}
+
+void EmbeddingIndex::reload()
+{
+    const auto serial = ++mSerial;
+    mEmbedding = false;
+    mStart = 0;
+    mBefore = 0;
+    mBatchSize = EMBED_BATCH_SIZE;
+    mFailed.clear();
+
+    mLoaded = false;
+    mDimensions = 0;
+    mVectors.clear();
+    mIds.clear();
+    mRows.clear();
+    Q_EMIT countChanged();
+
+    if (mModel.isEmpty())
+        return;
+
+    struct Stored {
+        qint32 dimensions = 0;
+        QByteArray vectors;
+        QVector<qint32> ids;
+        qint32 lastId = 0;
+    };
+
+    mStorage->read(this, [model = mModel](QSqlDatabase &db){
+        Stored res;
+
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        if (!q.exec("SELECT max(id) FROM messages"))
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+        if (q.next())
+            res.lastId = q.value(0).toInt();
+
+        q.prepare("SELECT message_id, vector FROM message_embeddings WHERE model = :model");
+        q.bindValue(":model", model);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+
+        while (q.next())
+        {
+            const auto vector = q.value(1).toByteArray();
+            if (!res.dimensions)
+                res.dimensions = vector.size();
+            if (vector.size() != res.dimensions)
+                continue;
+
+            res.ids << q.value(0).toInt();
+            res.vectors += vector;
+        }
+
+        return res;
+    }, [this, serial](const Stored &stored){
+        if (serial != mSerial)
+            return;
+
+        mDimensions = stored.dimensions;
+        mVectors = stored.vectors;
+        mIds = stored.ids;
+        for (int i=0; i<mIds.count(); i++)
+            mRows[mIds.at(i)] = i;
+
+        mStart = stored.lastId + 1;
+        mBefore = mStart;
+        mLoaded = true;
+        Q_EMIT countChanged();
+        indexNext();
+    });
+}
+
+void EmbeddingIndex::indexNext()
+{
+    if (!mLoaded || mEmbedding || mModel.isEmpty() || mBaseUrl.isEmpty())
+        return;
+
+    struct Batch {
+        QVector<qint32> ids;
+        QStringList texts;
+        bool done = false;
+    };
+
+    // Only rows without a vector for this model are sent. Edited rows lose
+    // their vector through a trigger, the older ones come back once the
+    // index is loaded again.
+    const auto serial = mSerial;
+    mStorage->read(this, [model = mModel, start = mStart, before = mBefore, limit = mBatchSize, failed = mFailed](QSqlDatabase &db){
+        Batch res;
+
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        q.prepare("SELECT m.id, substr(m.content, 1, :length) FROM messages m "
+                  "LEFT JOIN message_embeddings e ON e.message_id = m.id "
+                  "WHERE m.id >= :start AND (e.message_id IS NULL OR e.model <> :model) AND m.partial = 0 AND m.content <> '' "
+                  "ORDER BY m.id DESC");
+        q.bindValue(":length", EMBED_MAX_LENGTH);
+        q.bindValue(":start", start);
+        q.bindValue(":model", model);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+
+        while (res.ids.count() < limit && q.next())
+        {
+            const auto id = q.value(0).toInt();
+            if (failed.contains(id))
+                continue;
+
+            res.ids << id;
+            res.texts << q.value(1).toString();
+        }
+
+        // The older rows continue below the last batch, the rows walked
+        // past already have their vectors
+        res.done = (before <= 0);
+        if (res.ids.count() >= limit || res.done)
+            return res;
+
+        const auto rest = limit - res.ids.count();
+        q.prepare("SELECT m.id, substr(m.content, 1, :length) FROM messages m "
+                  "LEFT JOIN message_embeddings e ON e.message_id = m.id "
+                  "WHERE m.id < :before AND (e.message_id IS NULL OR e.model <> :model) AND m.partial = 0 AND m.content <> '' "
+                  "ORDER BY m.id DESC LIMIT :limit");
+        q.bindValue(":length", EMBED_MAX_LENGTH);
+        q.bindValue(":before", before);
+        q.bindValue(":model", model);
+        q.bindValue(":limit", rest);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+
+        qint32 count = 0;
+        while (q.next())
+        {
+            res.ids << q.value(0).toInt();
+            res.texts << q.value(1).toString();
+            count++;
+        }
+        res.done = (count < rest);
+
+        return res;
+    }, [this, serial](const Batch &batch){
+        if (serial != mSerial || mEmbedding || batch.ids.isEmpty())
+            return;
+
+        mEmbedding = true;
+        embed(batch.texts, this, [this, serial, batch, model = mModel](const QByteArray &data, QNetworkReply::NetworkError error){
+            if (serial != mSerial)
+                return;
+            mEmbedding = false;
+
+            // Without a connection the batch is retried the next time
+            // indexing is scheduled
+            if (error != QNetworkReply::NoError && error < QNetworkReply::ContentAccessDenied)
+            {
+                qDebug() << "embedding failed:" << error;
+                return;
+            }
+
+            const auto vectors = (error == QNetworkReply::NoError)? parseEmbeddings(data) : QList<QByteArray>();
+            if (vectors.count() != batch.ids.count())
+            {
+                // The server refused the batch, most likely for one text
+                // that is too long for the model. The batch is halved until
+                // that one is found and skipped.
+                qDebug() << "embedding failed for" << batch.ids.count() << "messages:" << error;
+                if (batch.ids.count() > 1)
+                    mBatchSize = qMax(1, batch.ids.count() / 2);
+                else
+                    skip(batch.ids.first(), batch.done);
+
+                indexNext();
+                return;
+            }
+
+            mStorage->write([ids = batch.ids, vectors, model](QSqlDatabase &db){
+                QSqlQuery q(db);
+                q.prepare("INSERT OR REPLACE INTO message_embeddings (message_id, model, vector) VALUES (:message_id, :model, :vector)");
+                for (int i=0; i<ids.count(); i++)
+                {
+                    q.bindValue(":message_id", ids.at(i));
+                    q.bindValue(":model", model);
+                    q.bindValue(":vector", vectors.at(i));
+                    if (!q.exec())
+                        qDebug() << q.lastError();
+                }
+            });
+
+            for (int i=0; i<batch.ids.count(); i++)
+            {
+                insert(batch.ids.at(i), vectors.at(i));
+                if (batch.ids.at(i) < mStart)
+                    mBefore = qMin(mBefore, batch.ids.at(i));
+            }
+            if (batch.done)
+                mBefore = 0;
+            mBatchSize = qMin(EMBED_BATCH_SIZE, mBatchSize * 2);
+            Q_EMIT countChanged();
+
+            indexNext();
+        }, NetworkService::Background);
+    });
+}
+
+void EmbeddingIndex::skip(qint32 messageId, bool done)
+{
+    if (messageId >= mStart)
+        mFailed.insert(messageId);
+    else
+        mBefore = done? 0 : qMin(mBefore, messageId);
+}
+
+void EmbeddingIndex::insert(qint32 messageId, const QByteArray &vector)
+{
+    if (!mDimensions)
+        mDimensions = vector.size();
+    if (vector.size() != mDimensions)
+        return;
+
+    const auto row = mRows.value(messageId, -1);
+    if (row >= 0)
+    {
+        std::memcpy(mVectors.data() + qsizetype(row) * mDimensions, vector.constData(), mDimensions);
+        return;
+    }
+
+    mRows[messageId] = mIds.count();
+    mIds << messageId;
+    mVectors += vector;
+}
+
+void EmbeddingIndex::embed(const QStringList &input, QObject *context, const NetworkService::Callback &callback, NetworkService::Priority priority)
+{
+    QNetworkRequest req;
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    req.setUrl(QUrl(mBaseUrl + "/embed"));
+
+    QJsonObject obj;
+    obj["model"] = mModel;
+    obj["input"] = QJsonArray::fromStringList(input);
+
+    NetworkService::instance()->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact), context, callback, priority);
+}
+
+void EmbeddingIndex::search(const QString &text, qint32 limit, QObject *context, const std::function<void(const QList<Hit>&)> &callback)
+{
+    if (!mLoaded || mIds.isEmpty() || mModel.isEmpty() || mBaseUrl.isEmpty())
+    {
+        callback(QList<Hit>());
+        return;
+    }
+
+    embed({text}, context, [this, limit, callback](const QByteArray &data, QNetworkReply::NetworkError error){
+        const auto vectors = parseEmbeddings(data);
+        if (vectors.isEmpty())
+        {
+            qDebug() << "embedding failed:" << error;
+            callback(QList<Hit>());
+            return;
+        }
+
+        callback(scan(vectors.first(), limit));
+    });
+}
+
+QList<EmbeddingIndex::Hit> EmbeddingIndex::scan(const QByteArray &query, qint32 limit) const
+{
+    QList<Hit> res;
+    if (query.size() != mDimensions || mIds.isEmpty() || limit <= 0)
+        return res;
+
+    // Plain int8 dot products over normalized vectors give the cosine.
+    // The inner loop has no branches, so the compiler turns it into SIMD.
+    const auto dims = mDimensions;
+    const auto q = reinterpret_cast<const qint8*>(query.constData());
+    const auto vectors = reinterpret_cast<const qint8*>(mVectors.constData());
+
+    QVector<QPair<qint32, qint32>> scores(mIds.count());
+    for (int i=0; i<mIds.count(); i++)
+    {
+        const auto v = vectors + qsizetype(i) * dims;
+        qint32 sum = 0;
+        for (int k=0; k<dims; k++)
+            sum += qint32(q[k]) * qint32(v[k]);
+        scores[i] = qMakePair(sum, i);
+    }
+
+    const auto count = qMin(limit, qint32(scores.count()));
+    std::partial_sort(scores.begin(), scores.begin() + count, scores.end(), [](const QPair<qint32, qint32> &a, const QPair<qint32, qint32> &b){
+        return a.first > b.first;
+    });
+
+    for (int i=0; i<count; i++)
+    {
+        Hit hit;
+        hit.messageId = mIds.at(scores.at(i).second);
+        hit.score = scores.at(i).first / float(EMBED_SCALE * EMBED_SCALE);
+        res << hit;
+    }
+
+    return res;
+}
+
+QList<QByteArray> EmbeddingIndex::parseEmbeddings(const QByteArray &data)
+{
+    QList<QByteArray> res;
+    const auto embeddings = QJsonDocument::fromJson(data).object().value("embeddings").toArray();
+    for (const auto &e: embeddings)
+        res << quantize(e.toArray());
+
+    return res;
+}
+
+QByteArray EmbeddingIndex::quantize(const QJsonArray &vector)
+{
+    double norm = 0;
+    for (const auto &v: vector)
+        norm += v.toDouble() * v.toDouble();
+    norm = std::sqrt(norm);
+
+    QByteArray res(vector.count(), 0);
+    if (norm <= 0)
+        return res;
+
+    for (int i=0; i<vector.count(); i++)
+        res[i] = char(qBound(-EMBED_SCALE, qRound(vector.at(i).toDouble() / norm * EMBED_SCALE), EMBED_SCALE));
+
+    return res;
+}
+
+float EmbeddingIndex::similarity(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return 0;
+
+    const auto x = reinterpret_cast<const qint8*>(a.constData());
+    const auto y = reinterpret_cast<const qint8*>(b.constData());
+
+    qint32 sum = 0;
+    for (int k=0; k<a.size(); k++)
+        sum += qint32(x[k]) * qint32(y[k]);
+
+    return sum / float(EMBED_SCALE * EMBED_SCALE);
+}
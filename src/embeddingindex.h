@@ -0,0 +1,91 @@
+#ifndef EMBEDDINGINDEX_H
+#define EMBEDDINGINDEX_H
+
+#include <QObject>
+#include <QNetworkReply>
+#include <QHash>
+#include <QSet>
+#include <QJsonArray>
+#include <QTimer>
+
+#include <functional>
+
+#include "storageservice.h"
+#include "networkservice.h"
+
+class EmbeddingIndex : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString model READ model WRITE setModel NOTIFY modelChanged FINAL)
+    Q_PROPERTY(QString baseUrl READ baseUrl WRITE setBaseUrl NOTIFY baseUrlChanged FINAL)
+
+public:
+    struct Hit {
+        qint32 messageId = 0;
+        float score = 0;
+    };
+
+    EmbeddingIndex(StorageService *storage, QObject *parent = nullptr);
+    virtual ~EmbeddingIndex();
+
+    QString model() const;
+    void setModel(const QString &newModel);
+
+    QString baseUrl() const;
+    void setBaseUrl(const QString &newBaseUrl);
+
+    qint32 count() const;
+
+    // Embeds the text with the index model and returns the closest stored
+    // messages, best first.
+    void search(const QString &text, qint32 limit, QObject *context, const std::function<void(const QList<Hit>&)> &callback);
+
+    static QList<QByteArray> parseEmbeddings(const QByteArray &data);
+    static QByteArray quantize(const QJsonArray &vector);
+    static float similarity(const QByteArray &a, const QByteArray &b);
+
+public Q_SLOTS:
+    void schedule();
+
+Q_SIGNALS:
+    void modelChanged();
+    void baseUrlChanged();
+    void countChanged();
+
+protected:
+    void reload();
+    void indexNext();
+    void insert(qint32 messageId, const QByteArray &vector);
+    void skip(qint32 messageId, bool done);
+    void embed(const QStringList &input, QObject *context, const NetworkService::Callback &callback, NetworkService::Priority priority = NetworkService::Interactive);
+
+    QList<Hit> scan(const QByteArray &query, qint32 limit) const;
+
+private:
+    StorageService *mStorage;
+    QTimer *mScheduleTimer;
+
+    QString mModel;
+    QString mBaseUrl;
+
+    qint32 mSerial = 0;
+    bool mLoaded = false;
+    bool mEmbedding = false;
+
+    // Messages stored before the index was loaded are walked down once,
+    // from mBefore on. Newer ones, from mStart up, are few and checked on
+    // every pass. Messages the server can't embed are skipped.
+    qint32 mStart = 0;
+    qint32 mBefore = 0;
+    qint32 mBatchSize = 0;
+    QSet<qint32> mFailed;
+
+    // Vectors are normalized and quantized to int8, one row after the
+    // other, so a search is a single pass over contiguous memory.
+    qint32 mDimensions = 0;
+    QByteArray mVectors;
+    QVector<qint32> mIds;
+    QHash<qint32, qint32> mRows;
+};
+
+#endif // EMBEDDINGINDEX_H
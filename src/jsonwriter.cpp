@@ -0,0 +1,198 @@
+#include "jsonwriter.h"
+
+JsonWriter::JsonWriter(QByteArray &buffer)
+    : mBuffer(buffer)
+{
+}
+
+void JsonWriter::separate()
+{
+    if (mNeedComma)
+        mBuffer += ',';
+}
+
+void JsonWriter::beginObject()
+{
+    separate();
+    mBuffer += '{';
+    mNeedComma = false;
+}
+
+void JsonWriter::endObject()
+{
+    mBuffer += '}';
+    mNeedComma = true;
+}
+
+void JsonWriter::beginArray()
+{
+    separate();
+    mBuffer += '[';
+    mNeedComma = false;
+}
+
+void JsonWriter::endArray()
+{
+    mBuffer += ']';
+    mNeedComma = true;
+}
+
+void JsonWriter::key(const char *name)
+{
+    separate();
+    mBuffer += '"';
+    mBuffer += name;
+    mBuffer += "\":";
+    mNeedComma = false;
+}
+
+void JsonWriter::value(const QString &text)
+{
+    separate();
+    escape(mBuffer, text);
+    mNeedComma = true;
+}
+
+void JsonWriter::value(const TextRope &text)
+{
+    separate();
+    escape(mBuffer, text);
+    mNeedComma = true;
+}
+
+void JsonWriter::value(qint32 number)
+{
+    value(qint64(number));
+}
+
+void JsonWriter::value(qint64 number)
+{
+    separate();
+    mBuffer += QByteArray::number(number);
+    mNeedComma = true;
+}
+
+void JsonWriter::value(bool flag)
+{
+    separate();
+    mBuffer += (flag? "true" : "false");
+    mNeedComma = true;
+}
+
+void JsonWriter::raw(const QByteArray &json)
+{
+    separate();
+    mBuffer += json;
+    mNeedComma = true;
+}
+
+void JsonWriter::escape(QByteArray &out, const QString &text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // Encodes UTF-16 to UTF-8 and escapes in the same pass, plain ASCII
+    // runs are the common case and take the first branch only.
+    out.reserve(out.size() + text.size() + 2);
+    out += '"';
+
+    const auto *p = text.utf16();
+    const auto *e = p + text.size();
+    while (p < e)
+    {
+        uint c = *p++;
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+        {
+            out += char(c);
+            continue;
+        }
+
+        if (c < 0x80)
+        {
+            out += '\\';
+            switch (c)
+            {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '\n': out += 'n'; break;
+            case '\r': out += 'r'; break;
+            case '\t': out += 't'; break;
+            case '\b': out += 'b'; break;
+            case '\f': out += 'f'; break;
+            default:
+                out += "u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            }
+            continue;
+        }
+
+        if (QChar::isHighSurrogate(c) && p < e && QChar::isLowSurrogate(*p))
+            c = QChar::surrogateToUcs4(ushort(c), *p++);
+        else if (QChar::isSurrogate(c))
+            c = QChar::ReplacementCharacter;
+
+        if (c < 0x800)
+        {
+            out += char(0xc0 | (c >> 6));
+        }
+        else if (c < 0x10000)
+        {
+            out += char(0xe0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+        }
+        else
+        {
+            out += char(0xf0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3f));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+        }
+        out += char(0x80 | (c & 0x3f));
+    }
+
+    out += '"';
+}
+
+void JsonWriter::escape(QByteArray &out, const TextRope &text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // The text is UTF-8 already, runs without quotes, backslashes and
+    // control characters are copied as they are.
+    out.reserve(out.size() + int(text.size()) + 2);
+    out += '"';
+
+    for (const auto &chunk: text.chunks())
+    {
+        const auto *data = chunk.constData();
+        const auto size = chunk.size();
+        qsizetype run = 0;
+        for (qsizetype i=0; i<size; i++)
+        {
+            const auto c = uchar(data[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            out.append(data + run, int(i - run));
+            run = i + 1;
+
+            out += '\\';
+            switch (c)
+            {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '\n': out += 'n'; break;
+            case '\r': out += 'r'; break;
+            case '\t': out += 't'; break;
+            case '\b': out += 'b'; break;
+            case '\f': out += 'f'; break;
+            default:
+                out += "u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            }
+        }
+        out.append(data + run, int(size - run));
+    }
+
+    out += '"';
+}
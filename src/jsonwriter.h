@@ -0,0 +1,42 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "textrope.h"
+
+// Writes compact JSON straight into a caller owned buffer. Values that are
+// already encoded can be spliced in with raw(), so unchanged parts of a
+// request are never serialized twice.
+class JsonWriter
+{
+public:
+    JsonWriter(QByteArray &buffer);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // Keys are plain ASCII literals and are written without escaping
+    void key(const char *name);
+
+    void value(const QString &text);
+    void value(const TextRope &text);
+    void value(qint32 number);
+    void value(qint64 number);
+    void value(bool flag);
+    void raw(const QByteArray &json);
+
+    static void escape(QByteArray &out, const QString &text);
+    static void escape(QByteArray &out, const TextRope &text);
+
+private:
+    void separate();
+
+    QByteArray &mBuffer;
+    bool mNeedComma = false;
+};
+
+#endif // JSONWRITER_H
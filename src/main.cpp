@@ -1,10 +1,14 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QElapsedTimer>
 #include <QStyleFactory>
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startup;
+    startup.start();
+
     QApplication app(argc, argv);
     app.setApplicationName("qllm");
     app.setApplicationDisplayName("QLLM");
@@ -18,6 +22,7 @@ int main(int argc, char *argv[])
     //     app.setStyle(style);
 
     MainWindow win;
+    win.setStartupTimer(startup);
     win.show();
 
     return app.exec();
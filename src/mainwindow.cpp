@@ -1,5 +1,8 @@
 #include "mainwindow.h"
 #include "settingsdialog.h"
+#include "contextmanager.h"
+#include "messageitem.h"
+#include "networkservice.h"
 #include "./ui_mainwindow.h"
 
 #include <QVariantMap>
@@ -10,7 +13,18 @@
 #include <QMessageBox>
 #include <QLabel>
 #include <QToolButton>
-
+#include <QScreen>
+#include <QGuiApplication>
+#include <QStatusBar>
+#include <QClipboard>
+#include <QFileDialog>
+#include <QTextEdit>
+#include <QDataStream>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+#define SESSION_SNAPSHOT_VERSION 1
 #define COLOR_TO_RGBA_STR(COLOR, ALPHA) QStringLiteral("rgba(%1, %2, %3, %4)").arg(COLOR.red()).arg(COLOR.green()).arg(COLOR.blue()).arg(ALPHA)
 
 MainWindow::MainWindow(QWidget *parent)
@@ -25,18 +39,152 @@ MainWindow::MainWindow(QWidget *parent)
     mChatsModel = new ChatsModel(this);
     mSession = new ChatSession(mChatsModel, this);
 
-    mScrollTimer = new QTimer(this);
-    mScrollTimer->setInterval(100);
-    mScrollTimer->setSingleShot(true);
+    mMessagesModel = new MessagesModel(mSession, this);
+    mMessageDelegate = new MessageDelegate(this);
 
-    connect(mScrollTimer, &QTimer::timeout, this, [this](){
-        ui->messages->verticalScrollBar()->setValue(ui->messages->verticalScrollBar()->maximum());
+    connect(mMessageDelegate, &MessageDelegate::menuRequested, this, &MainWindow::showMessageMenu);
+    connect(mSession, &ChatSession::streamingChanged, this, [this](qint32 chatId){
+        mChatsModel->setStreaming(chatId, mSession->isStreaming(chatId));
     });
 
-    connect(mSession, &ChatSession::messagesChanged, this, &MainWindow::print);
-
     ui->setupUi(this);
     ui->conversations->setModel(mChatsModel);
+    ui->conversations->setUniformItemSizes(true);
+
+    // The current chat may be further down than the pages loaded so far
+    connect(mChatsModel, &ChatsModel::revealed, this, [this](qint32 chatId){
+        if (chatId == mSession->currentChat())
+            ui->conversations->setCurrentIndex(mChatsModel->indexOf(chatId));
+    });
+
+    // Chats are loaded in the background as soon as they are pointed at
+    // or selected with the keyboard, opening them is instant afterwards
+    ui->conversations->setMouseTracking(true);
+    connect(ui->conversations, &QListView::entered, this, [this](const QModelIndex &index){
+        mSession->prefetch(mChatsModel->chatId(index));
+    });
+    connect(ui->conversations->selectionModel(), &QItemSelectionModel::currentChanged, this, [this](const QModelIndex &index){
+        mSession->prefetch(mChatsModel->chatId(index));
+    });
+
+    mEmbeddingIndex = new EmbeddingIndex(mChatsModel->storage(), this);
+    connect(mSession, &ChatSession::streamFinished, mEmbeddingIndex, &EmbeddingIndex::schedule);
+
+    // Files attached to a chat are indexed in the background and searched
+    // for every prompt sent to it.
+    mDocumentIndex = new DocumentIndex(mChatsModel->storage(), this);
+    mSession->setDocumentIndex(mDocumentIndex);
+    connect(mDocumentIndex, &DocumentIndex::indexingChanged, this, [this](){
+        if (mDocumentIndex->indexing())
+            statusBar()->showMessage(tr("Indexing attached files..."));
+        else
+            statusBar()->clearMessage();
+    });
+
+    mSearchModel = new SearchModel(mChatsModel->storage(), this);
+    mSearchModel->setEmbeddingIndex(mEmbeddingIndex);
+    ui->searchResults->setModel(mSearchModel);
+    ui->searchResults->setItemDelegate(new SearchDelegate(this));
+
+    ui->messages->setModel(mMessagesModel);
+    ui->messages->setItemDelegate(mMessageDelegate);
+    ui->messages->setUniformItemSizes(false);
+
+    // The row under the mouse gets a read only editor, so its text can be
+    // selected. It stays while something in it is selected.
+    ui->messages->setMouseTracking(true);
+    connect(ui->messages, &QListView::entered, this, [this](const QModelIndex &index){
+        if (mSelectable == index)
+            return;
+
+        if (mSelectable.isValid())
+        {
+            const auto editor = qobject_cast<QTextEdit*>(ui->messages->indexWidget(mSelectable));
+            if (editor && editor->textCursor().hasSelection())
+                return;
+            ui->messages->closePersistentEditor(mSelectable);
+        }
+
+        mSelectable = index;
+        ui->messages->openPersistentEditor(index);
+    });
+
+    // Rows that come into view get their real height once the view has
+    // settled, instead of from inside paint
+    mMeasureTimer = new QTimer(this);
+    mMeasureTimer->setInterval(0);
+    mMeasureTimer->setSingleShot(true);
+    connect(mMeasureTimer, &QTimer::timeout, this, [this](){ mMessageDelegate->measure(ui->messages); });
+    connect(mMessagesModel, &MessagesModel::modelReset, mMeasureTimer, qOverload<>(&QTimer::start));
+    connect(mMessagesModel, &MessagesModel::rowsInserted, mMeasureTimer, qOverload<>(&QTimer::start));
+
+    // Rows only change height while they are streamed, so the view is told
+    // to relayout just for the rows that have actually changed.
+    connect(mMessagesModel, &MessagesModel::dataChanged, this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight){
+        for (int row=topLeft.row(); row<=bottomRight.row(); row++)
+            Q_EMIT mMessageDelegate->sizeHintChanged(mMessagesModel->index(row));
+    });
+
+    // Older messages are loaded page by page when the view reaches the top.
+    // While a page is inserted the distance from the bottom is kept, so the
+    // visible messages stay where they are. New messages only scroll the
+    // view when it is already at the bottom.
+    connect(mMessagesModel, &MessagesModel::rowsAboutToBeInserted, this, [this](const QModelIndex &, int first, int){
+        if (first != 0 || mStickToBottom)
+            return;
+
+        const auto scrollBar = ui->messages->verticalScrollBar();
+        mScrollFromBottom = scrollBar->maximum() - scrollBar->value();
+        QTimer::singleShot(200, this, [this](){ mScrollFromBottom = -1; });
+    });
+    connect(mMessagesModel, &MessagesModel::modelReset, this, [this](){
+        mStickToBottom = !mSession->hasNewer();
+        mScrollFromBottom = -1;
+    });
+
+    // A search result opens its chat at the page of the found message
+    connect(mSession, &ChatSession::messageFocused, this, [this](const ChatSession::MessagePtr &msg){
+        mStickToBottom = false;
+        QMetaObject::invokeMethod(this, [this, msg](){
+            const auto idx = mMessagesModel->indexOf(msg);
+            if (idx.isValid())
+                ui->messages->scrollTo(idx, QAbstractItemView::PositionAtTop);
+
+            // A restored session also gets back to the pixel it was at
+            if (mRestoreOffset && idx.isValid())
+            {
+                const auto scrollBar = ui->messages->verticalScrollBar();
+                scrollBar->setValue(scrollBar->value() + mRestoreOffset);
+            }
+            mRestoreOffset = 0;
+        }, Qt::QueuedConnection);
+    });
+
+    const auto scrollBar = ui->messages->verticalScrollBar();
+    connect(scrollBar, &QScrollBar::valueChanged, this, [this](int value){
+        const auto scrollBar = ui->messages->verticalScrollBar();
+        if (mScrollFromBottom < 0)
+            mStickToBottom = (value >= scrollBar->maximum() - 4 && !mSession->hasNewer());
+        if (value == scrollBar->minimum() && scrollBar->maximum() > 0 && mSession->hasOlder() && mScrollFromBottom < 0)
+            mSession->fetchOlder();
+        if (value == scrollBar->maximum() && mSession->hasNewer())
+            mSession->fetchNewer();
+
+        mMessageDelegate->measure(ui->messages);
+    });
+    connect(scrollBar, &QScrollBar::rangeChanged, this, [this](int, int max){
+        if (mStickToBottom)
+            ui->messages->verticalScrollBar()->setValue(max);
+        else if (mScrollFromBottom >= 0)
+            ui->messages->verticalScrollBar()->setValue(max - mScrollFromBottom);
+
+        if (max == 0 && mSession->hasOlder())
+            QMetaObject::invokeMethod(mSession, &ChatSession::fetchOlder, Qt::QueuedConnection);
+        if (max == 0 && mSession->hasNewer())
+            QMetaObject::invokeMethod(mSession, &ChatSession::fetchNewer, Qt::QueuedConnection);
+
+        mMeasureTimer->start();
+    });
     ui->prompt->installEventFilter(this);
 
     const auto model = mSettings->value("Ollama/model").toString();
@@ -69,7 +217,25 @@ MainWindow::MainWindow(QWidget *parent)
 
     ui->toolBar->addWidget(toolbarWidget);
 
+    mPromptStatsLabel = new QLabel;
+    statusBar()->addPermanentWidget(mPromptStatsLabel);
+
+    connect(mSession, &ChatSession::promptStatsChanged, this, &MainWindow::reloadPromptStats);
+    connect(mSession, &ChatSession::cacheStatsChanged, this, &MainWindow::reloadPromptStats);
+    connect(NetworkService::instance(), &NetworkService::timingsChanged, this, &MainWindow::reloadPromptStats);
+
+    // The database is opened on the storage thread while the window is
+    // built. Its queue runs in order, so the chat list and the restored
+    // chat are read before the indexes, which are only loaded after the
+    // first paint together with everything that talks to the server.
+    connect(mChatsModel->storage(), &StorageService::opened, this, [this](bool success){
+        if (!success)
+            return;
+        mDatabaseTime = mStartupTimer.elapsed();
+        showStartupTime();
+    });
     mChatsModel->setFileLocation(dataDir + "/conversations.sqlite");
+    restoreSession();
 
     connect(mModelsCombo, static_cast<void(ModelsComboBox::*)(int)>(&ModelsComboBox::currentIndexChanged), this, &MainWindow::reloadPromptPlaceholder);
 
@@ -80,7 +246,7 @@ MainWindow::MainWindow(QWidget *parent)
 #endif
 
     initStyles();
-    initBaseUrl();
+    initContext();
     reloadPromptPlaceholder();
 }
 
@@ -106,43 +272,6 @@ void MainWindow::on_sendBtn_clicked()
     send();
 }
 
-void MainWindow::print()
-{
-    QString text;
-    bool allowPrint = false;
-    const auto messages = mSession->messages();
-    QSet<ChatSession::Message*> addedMessages;
-    QList<MessageItem*> items;
-    for (const auto &msg: messages)
-    {
-        addedMessages.insert(msg.get());
-        auto &item = mMessages[msg.get()];
-        if (item)
-        {
-            items << item;
-            continue;
-        }
-
-        item = new MessageItem(msg, mSession);
-        ui->messagesLayout->insertWidget(ui->messagesLayout->count()-1, item);
-        items << item;
-    }
-
-    const auto keys = mMessages.keys();
-    for (const auto k: keys)
-        if (!addedMessages.contains(k))
-        {
-            auto item = mMessages.take(k);
-            delete item;
-        }
-
-    if (!items.isEmpty())
-        items.last()->refresh();
-
-    if (!mScrollTimer->isActive())
-        mScrollTimer->start();
-}
-
 bool MainWindow::eventFilter(QObject *obj, QEvent *event)
 {
     if (obj == ui->prompt)
@@ -167,18 +296,111 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
     return QMainWindow::eventFilter(obj, event);
 }
 
+void MainWindow::setStartupTimer(const QElapsedTimer &timer)
+{
+    mStartupTimer = timer;
+}
+
+void MainWindow::paintEvent(QPaintEvent *e)
+{
+    QMainWindow::paintEvent(e);
+    if (mFirstPainted)
+        return;
+
+    mFirstPainted = true;
+    mFirstPaintTime = mStartupTimer.elapsed();
+    showStartupTime();
+
+    QMetaObject::invokeMethod(this, &MainWindow::initDeferred, Qt::QueuedConnection);
+}
+
+void MainWindow::showStartupTime()
+{
+    // The database may be ready before or after the first paint
+    if (mFirstPaintTime < 0)
+        return;
+
+    if (mDatabaseTime >= 0)
+        statusBar()->showMessage(tr("Started in %1ms, database ready in %2ms").arg(mFirstPaintTime).arg(mDatabaseTime), 5000);
+    else
+        statusBar()->showMessage(tr("Started in %1ms").arg(mFirstPaintTime), 5000);
+}
+
 void MainWindow::closeEvent(QCloseEvent *e)
 {
     mSettings->setValue("UI/geometry", saveGeometry());
     mSettings->setValue("UI/docks", saveState());
+    saveSession();
+    mSession->checkpoint();
     e->accept();
 }
 
+void MainWindow::on_messages_customContextMenuRequested(const QPoint &pos)
+{
+    const auto index = ui->messages->indexAt(pos);
+    if (!index.isValid())
+        return;
+
+    showMessageMenu(index, ui->messages->viewport()->mapToGlobal(pos));
+}
+
+void MainWindow::showMessageMenu(const QModelIndex &index, const QPoint &globalPos)
+{
+    const auto item = mMessagesModel->item(index);
+    if (!item)
+        return;
+
+    const auto msg = item->message();
+
+    QMenu menu;
+    auto copyAction = menu.addAction(tr("Copy"));
+    auto deleteAction = menu.addAction(tr("Delete"));
+    auto res = menu.exec(globalPos);
+
+    if (res == copyAction)
+    {
+        QApplication::clipboard()->setText( item->text() );
+    }
+    else if (res == deleteAction)
+    {
+        if (QMessageBox::warning(this, tr("Delete"), tr("Are you sure about delete this message?"), QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
+            return;
+
+        QMetaObject::invokeMethod(this, [this, msg](){
+            mSession->deleteMessage(msg);
+        }, Qt::QueuedConnection);
+    }
+}
+
 void MainWindow::on_conversations_clicked(const QModelIndex &index)
 {
     mSession->setCurrentChat( mChatsModel->chatId(index) );
 }
 
+void MainWindow::on_searchEdit_textChanged(const QString &text)
+{
+    mSearchModel->setQuery(text.trimmed());
+
+    const auto searching = !text.trimmed().isEmpty();
+    ui->searchResults->setVisible(searching);
+    ui->conversations->setVisible(!searching);
+}
+
+void MainWindow::on_semanticSearch_toggled(bool checked)
+{
+    mSearchModel->setSemantic(checked);
+}
+
+void MainWindow::on_searchResults_clicked(const QModelIndex &index)
+{
+    const auto chatId = index.data(SearchModel::ChatIdRole).toInt();
+    const auto messageId = index.data(SearchModel::MessageIdRole).toInt();
+
+    mRestoreOffset = 0;
+    mSession->jumpTo(chatId, messageId);
+    mChatsModel->reveal(chatId);
+}
+
 void MainWindow::on_conversations_customContextMenuRequested(const QPoint &)
 {
     const auto chatId = mChatsModel->chatId(ui->conversations->currentIndex());
@@ -188,24 +410,98 @@ void MainWindow::on_conversations_customContextMenuRequested(const QPoint &)
     QMenu menu;
     auto openAct = menu.addAction(tr("Open"));
     menu.addSeparator();
+    auto attachFolderAct = menu.addAction(tr("Attach Folder..."));
+    auto attachFileAct = menu.addAction(tr("Attach File..."));
+    auto detachMenu = menu.addMenu(tr("Detach"));
+    for (const auto &path: mDocumentIndex->sources(chatId))
+        detachMenu->addAction(path)->setData(path);
+    detachMenu->setEnabled(!detachMenu->isEmpty());
+    menu.addSeparator();
     auto deleteAct = menu.addAction(tr("Delete"));
 
     auto res = menu.exec(QCursor::pos());
+    if (!res)
+        return;
 
     if (res == openAct)
     {
         mSession->setCurrentChat(chatId);
     }
+    else if (res == attachFolderAct)
+    {
+        const auto path = QFileDialog::getExistingDirectory(this, tr("Attach Folder"));
+        if (path.count())
+            mDocumentIndex->attach(chatId, path);
+    }
+    else if (res == attachFileAct)
+    {
+        const auto path = QFileDialog::getOpenFileName(this, tr("Attach File"));
+        if (path.count())
+            mDocumentIndex->attach(chatId, path);
+    }
+    else if (res->parent() == detachMenu)
+    {
+        mDocumentIndex->detach(chatId, res->data().toString());
+    }
     else if (res == deleteAct)
     {
         if (QMessageBox::warning(this, tr("Delete"), tr("Are you sure about delete this conversation?"), QMessageBox::Yes|QMessageBox::No) != QMessageBox::Yes)
             return;
 
+        mSession->stopStream(chatId, true);
         mChatsModel->remove(chatId);
         mSession->setCurrentChat(0);
     }
 }
 
+void MainWindow::initDeferred()
+{
+    mDocumentIndex->reload();
+    initBaseUrl();
+    initSearch();
+}
+
+void MainWindow::saveSession()
+{
+    // The message at the top of the view and how far it is scrolled out.
+    // A view stuck to the bottom just opens the newest page again.
+    qint32 messageId = 0;
+    qint32 offset = 0;
+    if (!mStickToBottom)
+    {
+        const auto idx = ui->messages->indexAt(QPoint(1, 1));
+        const auto msg = mMessagesModel->message(idx);
+        if (msg)
+        {
+            messageId = msg->id;
+            offset = -ui->messages->visualRect(idx).top();
+        }
+    }
+
+    QByteArray snapshot;
+    QDataStream stream(&snapshot, QIODevice::WriteOnly);
+    stream << quint8(SESSION_SNAPSHOT_VERSION) << mSession->currentChat() << messageId << offset;
+    mSettings->setValue("Session/snapshot", snapshot);
+}
+
+void MainWindow::restoreSession()
+{
+    auto snapshot = mSettings->value("Session/snapshot").toByteArray();
+    QDataStream stream(&snapshot, QIODevice::ReadOnly);
+
+    quint8 version = 0;
+    qint32 chatId = 0;
+    qint32 messageId = 0;
+    qint32 offset = 0;
+    stream >> version >> chatId >> messageId >> offset;
+    if (stream.status() != QDataStream::Ok || version != SESSION_SNAPSHOT_VERSION || !chatId)
+        return;
+
+    mRestoreOffset = offset;
+    mSession->jumpTo(chatId, messageId);
+    mChatsModel->reveal(chatId);
+}
+
 void MainWindow::on_actionNew_Conversation_triggered()
 {
     mSession->setCurrentChat(0);
@@ -256,11 +552,88 @@ QString MainWindow::baseUrl() const
         return host + api;
 }
 
+void MainWindow::reloadPromptStats()
+{
+    const auto stats = mSession->promptStatsTotal();
+    const auto hits = mSession->cacheHits();
+    const auto misses = mSession->cacheMisses();
+
+    QStringList parts;
+    QStringList tips;
+    if (stats.promptTokens > 0)
+    {
+        const auto reused = 100.0 * (stats.promptTokens - stats.evaluatedTokens) / stats.promptTokens;
+        parts << tr("Prompt cache: %1% reused, ~%2s saved").arg(reused, 0, 'f', 0).arg(stats.savedTime / 1000.0, 0, 'f', 1);
+
+        const auto last = mSession->promptStats().last();
+        tips << tr("Last request: %1 of %2 prompt tokens evaluated in %3ms, first token after %4ms")
+                    .arg(last.evaluatedTokens).arg(last.promptTokens).arg(last.evalDuration).arg(last.timeToFirstToken);
+    }
+    if (hits + misses > 0)
+    {
+        parts << tr("Responses: %1 cached").arg(hits);
+        tips << tr("Response cache: %1 hits, %2 misses").arg(hits).arg(misses);
+    }
+
+    const auto timings = NetworkService::instance()->timings();
+    auto endpoints = timings.keys();
+    std::sort(endpoints.begin(), endpoints.end());
+
+    qint32 requests = 0;
+    for (const auto &endpoint: std::as_const(endpoints))
+    {
+        const auto t = timings.value(endpoint);
+        if (!t.requests)
+            continue;
+
+        requests += t.requests;
+        tips << tr("%1: %2 requests, %3 failed, %4 shared, %5ms average, %6ms max, %7ms queued")
+                    .arg(endpoint).arg(t.requests).arg(t.failures).arg(t.coalesced)
+                    .arg(t.totalTime / t.requests).arg(t.maxTime).arg(t.queuedTime);
+    }
+    if (parts.isEmpty() && requests)
+        parts << tr("Network: %1 requests").arg(requests);
+
+    mPromptStatsLabel->setText(parts.join(QStringLiteral(" | ")));
+    mPromptStatsLabel->setToolTip(tips.join(QStringLiteral("\n")));
+}
+
+void MainWindow::initContext()
+{
+    const auto context = mSession->contextManager();
+    context->setDefaultBudget(mSettings->value("Context/budget", 4096).toInt());
+    context->setBudgets(mSettings->value("Context/budgets").toMap());
+    context->setCompaction(mSettings->value("Context/compaction", false).toBool());
+    context->setPrefixStable(mSettings->value("Context/prefixStable", false).toBool());
+
+    mSession->setKeepAlive(mSettings->value("Ollama/keepAlive").toString());
+
+    mSession->setDeterministic(mSettings->value("Sampling/deterministic", false).toBool());
+    mSession->setSeed(mSettings->value("Sampling/seed", mSettings->value("Cache/seed", 0)).toInt());
+    mSession->setResponseCache(mSettings->value("Cache/enabled", false).toBool());
+    mSession->setResponseCacheLimit(mSettings->value("Cache/sizeLimit", 64).toLongLong() * 1024 * 1024);
+}
+
 void MainWindow::initBaseUrl()
 {
     mSession->setBaseUrl(baseUrl());
     mModelsCombo->setBaseUrl(baseUrl());
-    ui->secondSideModel->setBaseUrl(baseUrl());
+    if (ui->secondSideCheck->isChecked())
+        ui->secondSideModel->setBaseUrl(baseUrl());
+    mEmbeddingIndex->setBaseUrl(baseUrl());
+    mDocumentIndex->setBaseUrl(baseUrl());
+}
+
+void MainWindow::initSearch()
+{
+    // Searching by meaning needs an embedding model pulled into Ollama
+    const auto model = mSettings->value("Search/embeddingModel").toString();
+    mEmbeddingIndex->setModel(model);
+    mDocumentIndex->setModel(model);
+
+    ui->semanticSearch->setVisible(!model.isEmpty());
+    if (model.isEmpty())
+        ui->semanticSearch->setChecked(false);
 }
 
 QString MainWindow::readStyle(const QString &file) const
@@ -277,9 +650,7 @@ void MainWindow::initStyles()
 {
     const auto desktop = qgetenv("DESKTOP_SESSION");
 
-    QStringList files = {
-        ":/ui/stylesheets/chats.css",
-    };
+    QStringList files;
 
     const auto isPlasma = (desktop == "plasma");
     if (!isPlasma)
@@ -323,15 +694,44 @@ void MainWindow::initStyles()
         ui->actionNew_Conversation->setIcon(QIcon(":/ui/icons/list-add.svg"));
     }
 
-    QString styles;
+    // Message bubbles are painted by the delegate, not styled
+    mMessageDelegate->setBubbleColors(QColor(85, 170, 255, 25), isPlasma? areaColor : baseColor);
+    ui->messages->viewport()->update();
+
+    if (files.isEmpty())
+        return;
+
+    QString source;
     for (const auto &f: files)
-        styles += readStyle(f) + '\n';
+        source += readStyle(f) + '\n';
+
+    const QHash<QString, QString> colors = {
+        {QStringLiteral("base"), isPlasma? areaColor.name() : baseColor.name()},
+        {QStringLiteral("area"), isPlasma? baseColor.name() : areaColor.name()},
+        {QStringLiteral("border"), COLOR_TO_RGBA_STR(textColor, borderAlpha)},
+        {QStringLiteral("highlight"), highlightColor.name()},
+        {QStringLiteral("hover"), COLOR_TO_RGBA_STR(highlightColor, 0.2)},
+    };
+
+    // Substituted in a single pass over the sheet
+    static const QRegularExpression placeholder(QStringLiteral("color\\((\\w+)\\)"));
+
+    QString styles;
+    styles.reserve(source.size());
+    qsizetype last = 0;
+    auto it = placeholder.globalMatch(source);
+    while (it.hasNext())
+    {
+        const auto match = it.next();
+        const auto color = colors.constFind(match.captured(1));
+        if (color == colors.constEnd())
+            continue;
 
-    styles.replace("color(base)", isPlasma? areaColor.name() : baseColor.name());
-    styles.replace("color(area)", isPlasma? baseColor.name() : areaColor.name());
-    styles.replace("color(border)", COLOR_TO_RGBA_STR(textColor, borderAlpha));
-    styles.replace("color(highlight)", highlightColor.name());
-    styles.replace("color(hover)", COLOR_TO_RGBA_STR(highlightColor, 0.2));
+        styles.append(source.constData() + last, int(match.capturedStart() - last));
+        styles += color.value();
+        last = match.capturedEnd();
+    }
+    styles.append(source.constData() + last, int(source.size() - last));
 
     setStyleSheet(styles);
 }
@@ -345,6 +745,8 @@ void MainWindow::on_actionSettings_triggered()
     mSettingsDialog->exec();
 
     initBaseUrl();
+    initContext();
+    initSearch();
 }
 
 void MainWindow::on_clearBtn_clicked()
@@ -352,6 +754,9 @@ void MainWindow::on_clearBtn_clicked()
     if (QMessageBox::warning(this, tr("Clear"), tr("Are you sure about clear all conversations?"), QMessageBox::Yes|QMessageBox::No) != QMessageBox::Yes)
         return;
 
+    for (const auto chatId: mSession->streamingChats())
+        mSession->stopStream(chatId, true);
+
     mChatsModel->clear();
     mSession->setCurrentChat(0);
 }
@@ -366,6 +771,10 @@ void MainWindow::on_actionManage_Models_triggered()
 void MainWindow::on_secondSideCheck_clicked()
 {
     ui->secondSideModel->setDisabled(!ui->secondSideCheck->isChecked());
+
+    // Its models are only asked for once it is used
+    if (ui->secondSideCheck->isChecked())
+        ui->secondSideModel->setBaseUrl(baseUrl());
     initAutoAnswer();
 }
 
@@ -6,12 +6,19 @@
 #include <QSharedPointer>
 #include <QSettings>
 #include <QTimer>
+#include <QLabel>
+#include <QElapsedTimer>
 
 #include "chatsmodel.h"
 #include "chatsession.h"
 #include "modelscombobox.h"
 #include "settingsdialog.h"
-#include "messageitem.h"
+#include "messagesmodel.h"
+#include "messagedelegate.h"
+#include "searchmodel.h"
+#include "searchdelegate.h"
+#include "embeddingindex.h"
+#include "documentindex.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -27,12 +34,18 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Started by main() as early as possible, startup is timed against it
+    void setStartupTimer(const QElapsedTimer &timer);
+
 public Q_SLOTS:
     void send();
 
 private Q_SLOTS:
     void on_sendBtn_clicked();
     void on_conversations_clicked(const QModelIndex &index);
+    void on_searchEdit_textChanged(const QString &text);
+    void on_searchResults_clicked(const QModelIndex &index);
+    void on_semanticSearch_toggled(bool checked);
     void on_conversations_customContextMenuRequested(const QPoint &pos);
     void on_actionNew_Conversation_triggered();
     void on_actionSettings_triggered();
@@ -40,17 +53,26 @@ private Q_SLOTS:
     void on_actionManage_Models_triggered();
     void on_secondSideCheck_clicked();
     void on_secondSideModel_currentIndexChanged(int index);
+    void on_messages_customContextMenuRequested(const QPoint &pos);
 
 protected:
     bool eventFilter(QObject *obj, QEvent *event) override;
+    void paintEvent(QPaintEvent *e) override;
     void closeEvent(QCloseEvent *e) override;
 
-    void print();
+    void showMessageMenu(const QModelIndex &index, const QPoint &globalPos);
     void initSettings();
     void reloadPromptPlaceholder();
     void initAutoAnswer();
     void initBaseUrl();
+    void initContext();
+    void initSearch();
+    void reloadPromptStats();
     void initStyles();
+    void initDeferred();
+    void showStartupTime();
+    void saveSession();
+    void restoreSession();
 
     QString baseUrl() const;
     QString readStyle(const QString &file) const;
@@ -58,14 +80,28 @@ protected:
 private:
     Ui::MainWindow *ui;
     QSettings *mSettings;
-    QTimer *mScrollTimer;
 
     ChatsModel *mChatsModel;
     ChatSession *mSession;
+    MessagesModel *mMessagesModel;
+    MessageDelegate *mMessageDelegate;
+    SearchModel *mSearchModel;
+    EmbeddingIndex *mEmbeddingIndex;
+    DocumentIndex *mDocumentIndex;
 
     ModelsComboBox *mModelsCombo = nullptr;
     SettingsDialog *mSettingsDialog = nullptr;
+    QLabel *mPromptStatsLabel = nullptr;
+
+    qint32 mScrollFromBottom = -1;
+    bool mStickToBottom = true;
+    QTimer *mMeasureTimer;
+    qint32 mRestoreOffset = 0;
+    QPersistentModelIndex mSelectable;
 
-    QHash<ChatSession::Message*, MessageItem*> mMessages;
+    QElapsedTimer mStartupTimer;
+    bool mFirstPainted = false;
+    qint64 mFirstPaintTime = -1;
+    qint64 mDatabaseTime = -1;
 };
 #endif // MAINWINDOW_H
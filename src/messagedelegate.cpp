@@ -0,0 +1,245 @@
+#include "messagedelegate.h"
+#include "messageitem.h"
+#include "messagesmodel.h"
+
+#include <QAbstractScrollArea>
+#include <QHelpEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QTextEdit>
+#include <QToolTip>
+
+MessageDelegate::MessageDelegate(QObject *parent)
+    : QStyledItemDelegate{parent}
+{
+}
+
+MessageDelegate::~MessageDelegate()
+{
+}
+
+void MessageDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const auto item = itemOf(index);
+    if (!item)
+        return;
+
+    const auto isUser = (item->message()->role == ChatSession::User);
+    item->paint(painter, option, isUser? mUserColor : mAssistantColor, mEditing != index);
+}
+
+QSize MessageDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const auto model = qobject_cast<const MessagesModel*>(index.model());
+    const auto msg = model? model->message(index) : ChatSession::MessagePtr();
+    if (!msg)
+        return QSize();
+
+    // Heights are cached by the item per width, so a relayout of the view
+    // only lays out the texts of the rows whose content has changed. Rows
+    // not laid out at this width yet get an estimate, see measure().
+    const auto opt = itemOption(option);
+    const auto item = model->existingItem(index);
+    if (item && item->hasLayout(opt))
+    {
+        item->setSizedWidth(opt.rect.width());
+        return QSize(opt.rect.width(), item->heightForWidth(opt));
+    }
+
+    return QSize(opt.rect.width(), MessageItem::estimateHeight(msg, opt));
+}
+
+void MessageDelegate::measure(QAbstractItemView *view)
+{
+    const auto model = qobject_cast<const MessagesModel*>(view->model());
+    if (!model || !model->rowCount())
+        return;
+
+    QStyleOptionViewItem option;
+    option.widget = view;
+    option.font = view->font();
+    const auto opt = itemOption(option);
+
+    // Lays out the rows in the viewport that are still sized by an
+    // estimate. The view then relayouts once for all of them.
+    const auto viewport = view->viewport()->rect();
+    const auto top = view->indexAt(QPoint(viewport.center().x(), viewport.top()));
+
+    QModelIndex first;
+    for (int row = top.isValid()? top.row() : 0; row < model->rowCount(); row++)
+    {
+        const auto index = model->index(row);
+        const auto rect = view->visualRect(index);
+        if (rect.bottom() < viewport.top())
+            continue;
+        if (rect.top() > viewport.bottom())
+            break;
+
+        const auto item = model->item(index);
+        if (item->sizedWidth() == opt.rect.width() && item->hasLayout(opt))
+            continue;
+
+        item->heightForWidth(opt);
+        if (!first.isValid())
+            first = index;
+    }
+
+    if (first.isValid())
+        Q_EMIT sizeHintChanged(first);
+}
+
+bool MessageDelegate::helpEvent(QHelpEvent *event, QAbstractItemView *view, const QStyleOptionViewItem &option, const QModelIndex &index)
+{
+    const auto item = itemOf(index);
+    if (!item || event->type() != QEvent::ToolTip)
+        return QStyledItemDelegate::helpEvent(event, view, option, index);
+
+    const auto toolTip = item->toolTipAt(event->pos(), option);
+    if (toolTip.isEmpty())
+    {
+        QToolTip::hideText();
+        event->ignore();
+        return false;
+    }
+
+    QToolTip::showText(event->globalPos(), toolTip, view);
+    return true;
+}
+
+QWidget *MessageDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    auto editor = new QTextEdit(parent);
+    editor->setReadOnly(true);
+    editor->setTextInteractionFlags(Qt::TextSelectableByMouse | Qt::TextSelectableByKeyboard | Qt::LinksAccessibleByMouse);
+    editor->setFrameShape(QFrame::NoFrame);
+    editor->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    editor->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    editor->setWordWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+    editor->document()->setDocumentMargin(0);
+    editor->setFont(option.font);
+
+    // Transparent, the bubble painted below stays visible
+    editor->setAttribute(Qt::WA_TranslucentBackground);
+    editor->viewport()->setAutoFillBackground(false);
+    editor->setStyleSheet(QStringLiteral("QTextEdit { background: transparent; }"));
+
+    mEditing = index;
+    return editor;
+}
+
+void MessageDelegate::destroyEditor(QWidget *editor, const QModelIndex &index) const
+{
+    if (mEditing == index)
+        mEditing = QPersistentModelIndex();
+    QStyledItemDelegate::destroyEditor(editor, index);
+}
+
+void MessageDelegate::setEditorData(QWidget *editor, const QModelIndex &index) const
+{
+    const auto textEdit = qobject_cast<QTextEdit*>(editor);
+    const auto item = itemOf(index);
+    if (!textEdit || !item)
+        return;
+
+    // The editor is filled when the hover opens it. A streaming answer is
+    // not filled again on every frame, the editor catches up once it ends.
+    const auto msg = item->message();
+    const auto model = qobject_cast<const MessagesModel*>(index.model());
+    const auto filled = textEdit->property("contentSize");
+    if (filled.isValid())
+    {
+        if (model && model->isStreaming(index))
+            return;
+        if (filled.toLongLong() == msg->content.size() && textEdit->property("contentRevision").toUInt() == msg->content.revision())
+            return;
+    }
+    textEdit->setProperty("contentSize", msg->content.size());
+    textEdit->setProperty("contentRevision", msg->content.revision());
+
+    const auto dir = ChatSession::directionOf(msg);
+    auto textOption = textEdit->document()->defaultTextOption();
+    textOption.setTextDirection(dir);
+    textEdit->document()->setDefaultTextOption(textOption);
+
+    // Streamed updates keep what has been selected so far
+    const auto cursor = textEdit->textCursor();
+    if (msg->role == ChatSession::User)
+        textEdit->setPlainText(item->text());
+    else
+        textEdit->setMarkdown(item->text());
+
+    if (cursor.hasSelection())
+    {
+        auto restored = textEdit->textCursor();
+        restored.setPosition(qMin(cursor.anchor(), textEdit->document()->characterCount() - 1));
+        restored.setPosition(qMin(cursor.position(), textEdit->document()->characterCount() - 1), QTextCursor::KeepAnchor);
+        textEdit->setTextCursor(restored);
+    }
+}
+
+void MessageDelegate::setModelData(QWidget *, QAbstractItemModel *, const QModelIndex &) const
+{
+    // Messages are never edited in place
+}
+
+void MessageDelegate::updateEditorGeometry(QWidget *editor, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    const auto item = itemOf(index);
+    if (!item)
+        return;
+
+    editor->setGeometry(item->contentRect(option));
+}
+
+void MessageDelegate::setBubbleColors(const QColor &user, const QColor &assistant)
+{
+    mUserColor = user;
+    mAssistantColor = assistant;
+}
+
+bool MessageDelegate::editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option, const QModelIndex &index)
+{
+    if (event->type() != QEvent::MouseButtonRelease)
+        return QStyledItemDelegate::editorEvent(event, model, option, index);
+
+    const auto item = itemOf(index);
+    const auto mouseEvent = static_cast<QMouseEvent*>(event);
+    if (!item || mouseEvent->button() != Qt::LeftButton)
+        return false;
+
+    // The reasoning section collapses and expands on its own
+    if (item->thinkLabelRect(option).contains(mouseEvent->pos()))
+    {
+        item->setThinkCollapsed(!item->thinkCollapsed());
+        Q_EMIT sizeHintChanged(index);
+        return true;
+    }
+
+    const auto rect = item->menuRect(option);
+    if (!rect.contains(mouseEvent->pos()))
+        return false;
+
+    const auto widget = option.widget? qobject_cast<const QAbstractScrollArea*>(option.widget) : nullptr;
+    const auto pos = widget? widget->viewport()->mapToGlobal(rect.bottomLeft()) : mouseEvent->globalPos();
+    Q_EMIT menuRequested(index, pos);
+    return true;
+}
+
+MessageItem *MessageDelegate::itemOf(const QModelIndex &index) const
+{
+    const auto model = qobject_cast<const MessagesModel*>(index.model());
+    return model? model->item(index) : nullptr;
+}
+
+QStyleOptionViewItem MessageDelegate::itemOption(const QStyleOptionViewItem &option) const
+{
+    QStyleOptionViewItem res = option;
+
+    // The view does not pass the row geometry while sizing, rows always
+    // take the width of the viewport.
+    const auto view = qobject_cast<const QAbstractScrollArea*>(option.widget);
+    if (view)
+        res.rect = QRect(0, 0, view->viewport()->width(), 0);
+
+    return res;
+}
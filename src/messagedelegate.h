@@ -0,0 +1,51 @@
+#ifndef MESSAGEDELEGATE_H
+#define MESSAGEDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QPersistentModelIndex>
+#include <QAbstractItemView>
+
+class MessageItem;
+class MessageDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    MessageDelegate(QObject *parent = nullptr);
+    virtual ~MessageDelegate();
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+
+    bool helpEvent(QHelpEvent *event, QAbstractItemView *view, const QStyleOptionViewItem &option, const QModelIndex &index) Q_DECL_OVERRIDE;
+
+    // Text is selected in a read only editor laid over the content of the
+    // row under the mouse, the other rows are only painted
+    QWidget *createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    void destroyEditor(QWidget *editor, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    void setEditorData(QWidget *editor, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    void updateEditorGeometry(QWidget *editor, const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+
+    void setBubbleColors(const QColor &user, const QColor &assistant);
+
+    // Gives the rows that became visible their real height, before they
+    // are painted. Called when the view scrolls or its layout changes.
+    void measure(QAbstractItemView *view);
+
+Q_SIGNALS:
+    void menuRequested(const QModelIndex &index, const QPoint &globalPos);
+
+protected:
+    bool editorEvent(QEvent *event, QAbstractItemModel *model, const QStyleOptionViewItem &option, const QModelIndex &index) Q_DECL_OVERRIDE;
+
+    MessageItem *itemOf(const QModelIndex &index) const;
+    QStyleOptionViewItem itemOption(const QStyleOptionViewItem &option) const;
+
+private:
+    QColor mUserColor = QColor(85, 170, 255, 25);
+    QColor mAssistantColor;
+    mutable QPersistentModelIndex mEditing;
+};
+
+#endif // MESSAGEDELEGATE_H
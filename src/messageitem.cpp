@@ -1,28 +1,31 @@
 #include "messageitem.h"
-#include "ui_messageitem.h"
+#include "modelnames.h"
 
-#include <QClipboard>
-#include <QMenu>
-#include <QMessageBox>
-#include <QMetaMethod>
-#include <QRegularExpression>
+#include <QAbstractScrollArea>
+#include <QAbstractTextDocumentLayout>
+#include <QApplication>
+#include <QPainter>
+#include <QStyle>
+#include <QTextCursor>
+#include <QtMath>
 
-MessageItem::MessageItem(ChatSession::MessagePtr msg, ChatSession *session, QWidget *parent)
-    : QWidget{parent}
-    , ui(new Ui::MessageItem)
-    , mMessage(msg)
-    , mSession(session)
-{
-    ui->setupUi(this);
-
-    static const auto desktop = qgetenv("DESKTOP_SESSION");
-
-    ui->contentArea->setObjectName("contentArea_" + mMessage->role);
+#define ITEM_MARGIN 4
+#define ITEM_USER_TOP_MARGIN 30
+#define AVATAR_SIZE 30
+#define ITEM_SPACING 8
+#define HEADER_HEIGHT 32
+#define MENU_SIZE 24
+#define BUBBLE_PADDING 15
+#define BUBBLE_RADIUS 10
+#define BUBBLE_SPACING 10
+#define THINK_PADDING 20
+#define THINK_SPACING 6
 
-    if (mMessage->role == "user")
-        setContentsMargins(4,30,4,4);
-    else
-        setContentsMargins(4,4,4,4);
+MessageItem::MessageItem(ChatSession::MessagePtr msg)
+    : mMessage(msg)
+{
+    mThinkDoc.setDocumentMargin(0);
+    mThinkDoc.setUndoRedoEnabled(false);
 
     refresh();
 }
@@ -36,106 +39,564 @@ ChatSession::MessagePtr MessageItem::message() const
     return mMessage;
 }
 
+void MessageItem::setMessage(const ChatSession::MessagePtr &msg)
+{
+    if (mMessage == msg)
+        return;
+
+    // Revisions of different copies can't be compared, only the text
+    const auto &content = msg->content;
+    if (content.size() == mMessage->content.size() && content.toUtf8() == mMessage->content.toUtf8())
+        mContentRevision = content.revision();
+    else
+    {
+        mBlocks.clear();
+        mTailStart = 0;
+        mContentSize = -1;
+        mTextDirty = true;
+    }
+
+    mMessage = msg;
+}
+
 void MessageItem::refresh()
 {
-    auto content = mMessage->content;
-    const auto dir = directionOf(content);
+    const auto dir = ChatSession::directionOf(mMessage);
 
-    const QRegularExpression thinkRx("(.*)\\<\\/(?:think|response)\\>", QRegularExpression::MultilineOption|QRegularExpression::DotMatchesEverythingOption);
-    const QRegularExpression thinkRx2("\\<think\\>(.*)", QRegularExpression::MultilineOption|QRegularExpression::DotMatchesEverythingOption);
-    auto match = thinkRx.match(mMessage->content);
-    if (!match.hasMatch())
-        match = thinkRx2.match(mMessage->content);
-    if (match.hasMatch())
+    // The reasoning is split from the answer by the stream parser and
+    // only grows while streaming, so just the new part is appended.
+    const auto &think = mMessage->reasoning;
+    if (think.size() != mThink.size() || think != mThink)
     {
-        auto think = match.captured(0);
-        content.remove(think);
-        think.remove("<think>").remove("</think>").remove("</response>");
+        if (!mThinkDirty && think.size() > mThink.size() && QStringView(think).left(mThink.size()) == QStringView(mThink))
+            mThinkTail += think.mid(mThink.size());
+        else
+        {
+            mThinkDirty = true;
+            mThinkTail.clear();
+        }
 
-        ui->thinkArea->setVisible(true);
-        ui->think->setText(think.trimmed());
+        mThink = think;
+        mTextDirty = true;
+    }
 
+    if (mDirection != dir)
+    {
+        mDirection = dir;
+        mTextDirty = true;
+        mThinkDirty = true;
+        for (auto &block: mBlocks)
+            block.dirty = true;
     }
-    else
-        ui->thinkArea->setVisible(false);
 
-    content = content.trimmed();
-    setLayoutDirection(dir);
+    updateBlocks();
 
-    if (mMessage->role == "user")
+    if (mMessage->role == ChatSession::User)
     {
-        ui->content->setTextFormat(Qt::PlainText);
-        ui->avatar->setText(QString::fromUtf8("🙂"));
-        ui->sender->setText(tr("You"));
+        mAvatar = QString::fromUtf8("🙂");
+        mSender = tr("You");
     }
     else
     {
-        ui->content->setTextFormat(Qt::MarkdownText);
-        ui->avatar->setText(QString::fromUtf8("🤖"));
-        ui->sender->setText(mMessage->model);
+        mAvatar = QString::fromUtf8("🤖");
+        mSender = ModelNames::name(mMessage->model);
+    }
+
+    mDatetime = mMessage->datetime.toString("yyyy-MM-dd hh:mm:ss");
+
+    const auto &stats = mMessage->stats;
+    mStats.clear();
+    mStatsToolTip.clear();
+    if (stats.isValid())
+    {
+        QStringList parts;
+        if (stats.evalDuration > 0)
+            parts << tr("%1 tok/s").arg(stats.evalCount * 1e9 / stats.evalDuration, 0, 'f', 1);
+        if (stats.timeToFirstToken >= 0)
+            parts << tr("%1s to first token").arg(stats.timeToFirstToken / 1000.0, 0, 'f', 2);
+        mStats = parts.join(QStringLiteral(" · "));
+
+        mStatsToolTip = tr("Total: %1ms\nLoad: %2ms\nPrompt: %3 tokens in %4ms\nAnswer: %5 tokens in %6ms\nFirst byte: %7ms\nFirst token: %8ms")
+                            .arg(stats.totalDuration / 1000000)
+                            .arg(stats.loadDuration / 1000000)
+                            .arg(stats.promptEvalCount)
+                            .arg(stats.promptEvalDuration / 1000000)
+                            .arg(stats.evalCount)
+                            .arg(stats.evalDuration / 1000000)
+                            .arg(stats.timeToFirstByte)
+                            .arg(stats.timeToFirstToken);
+    }
+    else if (mMessage->partial)
+    {
+        mStats = tr("interrupted");
+        mStatsToolTip = tr("The answer was cut off before it finished streaming");
+    }
+
+    mTextDirty = true;
+}
+
+qint32 MessageItem::heightForWidth(const QStyleOptionViewItem &option)
+{
+    layout(option);
+    return mHeight;
+}
+
+bool MessageItem::hasLayout(const QStyleOptionViewItem &option) const
+{
+    return mWidth >= 0 && mWidth == option.rect.width() && mFont == option.font;
+}
+
+qint32 MessageItem::sizedWidth() const
+{
+    return mSizedWidth;
+}
+
+void MessageItem::setSizedWidth(qint32 width)
+{
+    mSizedWidth = width;
+}
+
+qint32 MessageItem::estimateHeight(const ChatSession::MessagePtr &msg, const QStyleOptionViewItem &option)
+{
+    const QFontMetrics fm(option.font);
+    const auto textWidth = qMax(1, option.rect.width() - 2*ITEM_MARGIN - AVATAR_SIZE - ITEM_SPACING - 2*BUBBLE_PADDING);
+    const auto charsPerLine = qMax(1, textWidth / qMax(1, fm.averageCharWidth()));
+
+    // Wrapped lines from the length, plus one for every line break. The
+    // size is in UTF-8 bytes, which overestimates other scripts a bit.
+    qint64 lines = 0;
+    for (const auto &chunk: msg->content.chunks())
+        lines += chunk.count('\n');
+    lines += msg->content.size() / charsPerLine + 1;
+
+    auto height = (msg->role == ChatSession::User? ITEM_USER_TOP_MARGIN : ITEM_MARGIN) + HEADER_HEIGHT + 2*BUBBLE_PADDING + ITEM_MARGIN;
+    height += qint32(qMin<qint64>(lines, 100000) * fm.lineSpacing());
+    if (!msg->reasoning.isEmpty())
+    {
+        const auto thinkLines = msg->reasoning.count(QLatin1Char('\n')) + msg->reasoning.size() / charsPerLine + 1;
+        height += 2*THINK_PADDING + THINK_SPACING + BUBBLE_SPACING + (thinkLines + 1) * fm.lineSpacing();
     }
 
-    ui->content->setText(content);
-    ui->datetime->setText(mMessage->datetime.toString("yyyy-MM-dd hh:mm:ss"));
+    return height;
 }
 
-Qt::LayoutDirection MessageItem::directionOf(const QString &str)
+void MessageItem::layout(const QStyleOptionViewItem &option)
 {
-    Qt::LayoutDirection res = Qt::LeftToRight;
-    if( str.isEmpty() )
-        return res;
+    const auto width = option.rect.width();
+    const auto fontChanged = (option.font != mFont);
+    if (!mTextDirty && width == mWidth && !fontChanged)
+        return;
+
+    if (fontChanged)
+    {
+        mFont = option.font;
+        mThinkDirty = true;
+        for (auto &block: mBlocks)
+            block.dirty = true;
+    }
+
+    QTextOption textOption;
+    textOption.setTextDirection(mDirection);
+    textOption.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+
+    const auto textWidth = qMax(0, width - 2*ITEM_MARGIN - AVATAR_SIZE - ITEM_SPACING - 2*BUBBLE_PADDING);
+    const auto spacing = QFontMetrics(mFont).height() / 2;
+
+    mContentHeight = 0;
+    for (auto &block: mBlocks)
+    {
+        layoutBlock(block, textOption, textWidth);
+        if (block.height == 0)
+            continue;
+        if (mContentHeight)
+            mContentHeight += spacing;
+        mContentHeight += block.height;
+    }
+
+    if (mThinkDirty)
+    {
+        mThinkDoc.setDefaultFont(mFont);
+        mThinkDoc.setDefaultTextOption(textOption);
+        mThinkDoc.setPlainText(mThink);
+        mThinkDirty = false;
+    }
+    else if (mThinkTail.count())
+    {
+        QTextCursor cursor(&mThinkDoc);
+        cursor.movePosition(QTextCursor::End);
+        cursor.insertText(mThinkTail);
+    }
+    mThinkTail.clear();
+    if (!mThink.isEmpty())
+        mThinkDoc.setTextWidth(qMax(0, textWidth - 2*THINK_PADDING));
+
+    mTextDirty = false;
+    mWidth = width;
+
+    const auto g = geometry(QRect(0, 0, width, 0));
+    mHeight = g.bubble.bottom() + 1 + ITEM_MARGIN;
+}
+
+void MessageItem::layoutBlock(Block &block, const QTextOption &textOption, qint32 width)
+{
+    if (!block.dirty && block.doc && qRound(block.doc->textWidth()) == width)
+        return;
+
+    if (!block.doc)
+    {
+        block.doc.reset(new QTextDocument);
+        block.doc->setDocumentMargin(0);
+        block.doc->setUndoRedoEnabled(false);
+    }
+
+    block.doc->setTextWidth(width);
+    if (block.dirty)
+    {
+        block.doc->setDefaultFont(mFont);
+        block.doc->setDefaultTextOption(textOption);
+        if (mMessage->role == ChatSession::User)
+            block.doc->setPlainText(block.text);
+        else
+            block.doc->setMarkdown(block.text);
+        block.dirty = false;
+    }
+
+    block.height = block.text.isEmpty()? 0 : qCeil(block.doc->size().height());
+}
+
+void MessageItem::updateBlocks()
+{
+    const auto &content = mMessage->content;
+    const auto unchanged = (content.revision() == mContentRevision && content.size() == mContentSize);
+    if (unchanged && !mBlocks.isEmpty())
+        return;
+
+    // Only appending keeps the completed blocks, anything else starts over
+    const auto valid = (content.revision() == mContentRevision && mTailStart <= content.size() && mContentSize <= content.size());
+    mContentRevision = content.revision();
+    mContentSize = content.size();
+
+    // User messages are plain text and never streamed
+    if (mMessage->role == ChatSession::User)
+    {
+        if (mBlocks.isEmpty())
+            mBlocks.append(Block());
+        mBlocks.first().text = content.toString().trimmed();
+        mBlocks.first().dirty = true;
+        mTextDirty = true;
+        return;
+    }
+
+    if (!valid)
+    {
+        mBlocks.clear();
+        mTailStart = 0;
+        mTextDirty = true;
+    }
+
+    Block tail;
+    if (!mBlocks.isEmpty())
+        tail = mBlocks.takeLast();
+
+    const auto text = content.toString(mTailStart);
+    qint32 from = 0;
+    qint32 next = 0;
+    for (auto end = blockEnd(text, from, &next); end >= 0; end = blockEnd(text, from, &next))
+    {
+        Block block;
+        block.start = mTailStart;
+        block.text = text.mid(from, end - from);
+        mBlocks.append(block);
 
-    int ltr = 0;
-    int rtl = 0;
+        mTailStart += utf8Size(QStringView(text).mid(from, next - from));
+        from = next;
+        tail.dirty = true;
+        mTextDirty = true;
+    }
 
-    for(const QChar &ch: str)
+    const auto tailText = text.mid(from);
+    if (tail.text != tailText)
     {
-        QChar::Direction dir = ch.direction();
-        switch( static_cast<int>(dir) )
+        tail.text = tailText;
+        tail.dirty = true;
+        mTextDirty = true;
+    }
+
+    tail.start = mTailStart;
+    mBlocks.append(tail);
+}
+
+qint32 MessageItem::blockEnd(const QString &text, qint32 from, qint32 *next)
+{
+    // A block ends at a blank line outside of code fences, once the next
+    // line is complete and turns out not to continue it (list items and
+    // indented lines do).
+    auto fenced = false;
+    auto hasContent = false;
+    qint32 blankStart = -1;
+    auto lineStart = from;
+    while (lineStart < text.size())
+    {
+        const auto lineEnd = text.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd < 0)
+            return -1;
+
+        const auto line = QStringView(text).mid(lineStart, lineEnd - lineStart);
+        const auto trimmed = line.trimmed();
+        if (trimmed.isEmpty())
         {
-        case QChar::DirL:
-        case QChar::DirLRE:
-        case QChar::DirLRO:
-        case QChar::DirEN:
-            ltr++;
-            break;
+            if (!fenced && hasContent && blankStart < 0)
+                blankStart = lineStart;
+        }
+        else
+        {
+            if (blankStart >= 0 && !isContinuation(line))
+            {
+                *next = lineStart;
+                return blankStart;
+            }
 
-        case QChar::DirR:
-        case QChar::DirRLE:
-        case QChar::DirRLO:
-        case QChar::DirAL:
-            rtl++;
-            break;
+            blankStart = -1;
+            hasContent = true;
+            if (trimmed.startsWith(QLatin1String("```")) || trimmed.startsWith(QLatin1String("~~~")))
+                fenced = !fenced;
         }
+
+        lineStart = lineEnd + 1;
+    }
+
+    return -1;
+}
+
+qint64 MessageItem::utf8Size(QStringView text)
+{
+    qint64 size = 0;
+    for (const auto ch: text)
+    {
+        const auto c = ch.unicode();
+        if (c < 0x80)
+            size += 1;
+        else if (c < 0x800)
+            size += 2;
+        else if (ch.isSurrogate())
+            size += 2; // four bytes per pair
+        else
+            size += 3;
     }
+    return size;
+}
 
-    if( ltr >= rtl * 3 )
-        res = Qt::LeftToRight;
+bool MessageItem::isContinuation(QStringView line)
+{
+    if (line.isEmpty())
+        return false;
+
+    const auto first = line.at(0);
+    if (first == QLatin1Char(' ') || first == QLatin1Char('\t'))
+        return true;
+
+    if (line.size() >= 2 && line.at(1) == QLatin1Char(' ') && (first == QLatin1Char('-') || first == QLatin1Char('*') || first == QLatin1Char('+')))
+        return true;
+
+    int i = 0;
+    while (i < line.size() && line.at(i).isDigit())
+        i++;
+
+    return i > 0 && i + 1 < line.size() && (line.at(i) == QLatin1Char('.') || line.at(i) == QLatin1Char(')')) && line.at(i+1) == QLatin1Char(' ');
+}
+
+MessageItem::Geometry MessageItem::geometry(const QRect &rect) const
+{
+    Geometry g;
+
+    const auto top = rect.top() + (mMessage->role == ChatSession::User? ITEM_USER_TOP_MARGIN : ITEM_MARGIN);
+    const auto left = rect.left() + ITEM_MARGIN;
+    const auto right = rect.right() - ITEM_MARGIN;
+    const auto areaLeft = left + AVATAR_SIZE + ITEM_SPACING;
+
+    g.avatar = QRect(left, top, AVATAR_SIZE, AVATAR_SIZE);
+
+    QFont bold = mFont;
+    bold.setBold(true);
+    const QFontMetrics fm(mFont);
+    const QFontMetrics boldFm(bold);
+
+    g.menu = QRect(right - MENU_SIZE + 1, top + (HEADER_HEIGHT - MENU_SIZE) / 2, MENU_SIZE, MENU_SIZE);
+    g.datetime = QRect(g.menu.left() - ITEM_SPACING - fm.horizontalAdvance(mDatetime), top, fm.horizontalAdvance(mDatetime), HEADER_HEIGHT);
+    if (mStats.isEmpty())
+        g.stats = QRect(g.datetime.left(), top, 0, HEADER_HEIGHT);
     else
-        res = Qt::RightToLeft;
+        g.stats = QRect(g.datetime.left() - ITEM_SPACING - fm.horizontalAdvance(mStats), top, fm.horizontalAdvance(mStats), HEADER_HEIGHT);
+    g.sender = QRect(areaLeft, top, qMax(0, qMin(boldFm.horizontalAdvance(mSender), g.stats.left() - ITEM_SPACING - areaLeft)), HEADER_HEIGHT);
+
+    const auto innerLeft = areaLeft + BUBBLE_PADDING;
+    auto y = top + HEADER_HEIGHT + BUBBLE_PADDING;
+    if (!mThink.isEmpty())
+    {
+        QFont thinkFont = bold;
+        thinkFont.setItalic(true);
+        const auto thinkLabelHeight = QFontMetrics(thinkFont).height();
+        const auto thinkHeight = mThinkCollapsed? 0 : qCeil(mThinkDoc.size().height());
+        const auto thinkWidth = qCeil(mThinkDoc.textWidth());
+
+        g.thinkLabel = QRect(innerLeft + THINK_PADDING, y + THINK_PADDING, thinkWidth, thinkLabelHeight);
+        g.thinkText = QRect(innerLeft + THINK_PADDING, g.thinkLabel.bottom() + 1 + (mThinkCollapsed? 0 : THINK_SPACING), thinkWidth, thinkHeight);
+        g.think = QRect(innerLeft, y, thinkWidth + 2*THINK_PADDING, g.thinkText.bottom() + 1 + THINK_PADDING - y);
+        y = g.think.bottom() + 1 + BUBBLE_SPACING;
+    }
+
+    g.content = QRect(innerLeft, y, qMax(0, right - innerLeft + 1 - BUBBLE_PADDING), mContentHeight);
+    g.bubble = QRect(areaLeft, top + HEADER_HEIGHT, qMax(0, right - areaLeft + 1), g.content.bottom() + 1 + BUBBLE_PADDING - top - HEADER_HEIGHT);
+
+    // Everything is laid out left to right and mirrored for RTL messages
+    if (mDirection == Qt::RightToLeft)
+    {
+        const auto mirror = [&rect](QRect &r){ r = QStyle::visualRect(Qt::RightToLeft, rect, r); };
+        mirror(g.avatar);
+        mirror(g.sender);
+        mirror(g.stats);
+        mirror(g.datetime);
+        mirror(g.menu);
+        mirror(g.bubble);
+        mirror(g.think);
+        mirror(g.thinkLabel);
+        mirror(g.thinkText);
+        mirror(g.content);
+    }
 
-    return res;
+    return g;
 }
 
-void MessageItem::on_menuBtn_clicked()
+void MessageItem::paint(QPainter *painter, const QStyleOptionViewItem &option, const QColor &bubbleColor, bool content)
 {
-    QMenu menu;
-    auto copyAction = menu.addAction("Copy");
-    auto deleteAction = menu.addAction("Delete");
-    auto res = menu.exec( ui->menuBtn->mapToGlobal(ui->menuBtn->rect().bottomLeft()) );
+    layout(option);
+    const auto g = geometry(option.rect);
+    const auto &plt = option.palette;
+    const auto align = Qt::AlignVCenter | (mDirection == Qt::RightToLeft? Qt::AlignRight : Qt::AlignLeft);
 
-    if (res == copyAction)
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+
+    QFont avatarFont = option.font;
+    avatarFont.setPointSize(20);
+    painter->setFont(avatarFont);
+    painter->setPen(plt.color(QPalette::Text));
+    painter->drawText(g.avatar, Qt::AlignCenter, mAvatar);
+
+    QFont bold = option.font;
+    bold.setBold(true);
+    painter->setFont(bold);
+    painter->drawText(g.sender, align, QFontMetrics(bold).elidedText(mSender, Qt::ElideRight, g.sender.width()));
+
+    painter->setFont(option.font);
+    painter->drawText(g.datetime, align, mDatetime);
+    painter->drawText(g.menu, Qt::AlignCenter, QStringLiteral("..."));
+    if (!mStats.isEmpty())
     {
-        QApplication::clipboard()->setText( ui->content->text() );
+        painter->setPen(plt.color(QPalette::Disabled, QPalette::Text));
+        painter->drawText(g.stats, align, mStats);
     }
-    else if (res == deleteAction)
+
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(bubbleColor);
+    painter->drawRoundedRect(g.bubble, BUBBLE_RADIUS, BUBBLE_RADIUS);
+
+    QAbstractTextDocumentLayout::PaintContext ctx;
+    ctx.palette = plt;
+    ctx.palette.setColor(QPalette::Text, plt.color(QPalette::Text));
+
+    if (!mThink.isEmpty())
     {
-        if (QMessageBox::warning(this, tr("Delete"), tr("Are you sure about delete this message?"), QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
-            return;
+        painter->setBrush(QColor(0, 0, 0, 18));
+        painter->drawRoundedRect(g.think, BUBBLE_RADIUS, BUBBLE_RADIUS);
 
-        QMetaObject::invokeMethod(this, [this](){
-            mSession->deleteMessage(mMessage);
-        }, Qt::QueuedConnection);
+        QFont thinkFont = bold;
+        thinkFont.setItalic(true);
+        painter->setFont(thinkFont);
+        painter->setPen(plt.color(QPalette::Text));
+        painter->drawText(g.thinkLabel, align, mThinkCollapsed? tr("Thinking...") : tr("Thinking:"));
+
+        if (!mThinkCollapsed)
+        {
+            painter->save();
+            painter->translate(g.thinkText.topLeft());
+            mThinkDoc.documentLayout()->draw(painter, ctx);
+            painter->restore();
+        }
     }
+
+    const auto spacing = QFontMetrics(mFont).height() / 2;
+    auto clip = option.rect;
+    const auto view = qobject_cast<const QAbstractScrollArea*>(option.widget);
+    if (view)
+        clip &= view->viewport()->rect();
+
+    auto y = g.content.top();
+    for (const auto &block: std::as_const(mBlocks))
+    {
+        if (!content)
+            break;
+
+        if (block.height == 0)
+            continue;
+
+        // Blocks scrolled out of the view are not drawn at all
+        if (y + block.height >= clip.top() && y <= clip.bottom())
+        {
+            painter->save();
+            painter->translate(g.content.left(), y);
+            block.doc->documentLayout()->draw(painter, ctx);
+            painter->restore();
+        }
+
+        y += block.height + spacing;
+    }
+    painter->restore();
 }
 
+QRect MessageItem::menuRect(const QStyleOptionViewItem &option)
+{
+    layout(option);
+    return geometry(option.rect).menu;
+}
+
+QRect MessageItem::contentRect(const QStyleOptionViewItem &option)
+{
+    layout(option);
+    return geometry(option.rect).content;
+}
+
+QString MessageItem::toolTipAt(const QPoint &pos, const QStyleOptionViewItem &option)
+{
+    layout(option);
+    const auto g = geometry(option.rect);
+    if (g.stats.contains(pos))
+        return mStatsToolTip;
+
+    return QString();
+}
+
+QRect MessageItem::thinkLabelRect(const QStyleOptionViewItem &option)
+{
+    layout(option);
+    return geometry(option.rect).thinkLabel;
+}
+
+bool MessageItem::thinkCollapsed() const
+{
+    return mThinkCollapsed;
+}
+
+void MessageItem::setThinkCollapsed(bool collapsed)
+{
+    if (mThinkCollapsed == collapsed)
+        return;
+
+    mThinkCollapsed = collapsed;
+    mTextDirty = true;
+}
+
+QString MessageItem::text() const
+{
+    return mMessage->content.toString().trimmed();
+}
@@ -3,36 +3,113 @@
 
 #include "chatsession.h"
 
-#include <QWidget>
+#include <QCoreApplication>
+#include <QSharedPointer>
+#include <QStyleOptionViewItem>
+#include <QTextDocument>
 
-QT_BEGIN_NAMESPACE
-namespace Ui {
-class MessageItem;
-}
-QT_END_NAMESPACE
-
-class MessageItem : public QWidget
+class MessageItem
 {
-    Q_OBJECT
+    Q_DECLARE_TR_FUNCTIONS(MessageItem)
+
 public:
-    explicit MessageItem(ChatSession::MessagePtr msg, ChatSession *session, QWidget *parent = nullptr);
+    explicit MessageItem(ChatSession::MessagePtr msg);
     virtual ~MessageItem();
 
     ChatSession::MessagePtr message() const;
 
-public Q_SLOTS:
+    // Moves the item to a reloaded copy of its message. The laid out
+    // blocks are kept while the text is the same.
+    void setMessage(const ChatSession::MessagePtr &msg);
+
     void refresh();
 
+    qint32 heightForWidth(const QStyleOptionViewItem &option);
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QColor &bubbleColor, bool content = true);
+
+    // Whether the item has been laid out for this width before, so its
+    // height is known or cheap to update
+    bool hasLayout(const QStyleOptionViewItem &option) const;
+
+    // Width the view was last given the real height for. Until then the
+    // row is sized by an estimate, even if it has been painted.
+    qint32 sizedWidth() const;
+    void setSizedWidth(qint32 width);
+
+    // Rough height of a row that has never been shown, without laying out
+    // or even splitting its text
+    static qint32 estimateHeight(const ChatSession::MessagePtr &msg, const QStyleOptionViewItem &option);
+
+    QRect menuRect(const QStyleOptionViewItem &option);
+    QRect contentRect(const QStyleOptionViewItem &option);
+    QString toolTipAt(const QPoint &pos, const QStyleOptionViewItem &option);
+    QRect thinkLabelRect(const QStyleOptionViewItem &option);
+
+    bool thinkCollapsed() const;
+    void setThinkCollapsed(bool collapsed);
+
+    QString text() const;
+
 protected:
-    static Qt::LayoutDirection directionOf(const QString &str);
+    struct Geometry {
+        QRect avatar;
+        QRect sender;
+        QRect stats;
+        QRect datetime;
+        QRect menu;
+        QRect bubble;
+        QRect think;
+        QRect thinkLabel;
+        QRect thinkText;
+        QRect content;
+    };
+
+    struct Block {
+        qint64 start = 0;
+        qint32 height = 0;
+        QString text;
+        QSharedPointer<QTextDocument> doc;
+        bool dirty = true;
+    };
+
+    void layout(const QStyleOptionViewItem &option);
+    void layoutBlock(Block &block, const QTextOption &textOption, qint32 width);
+    Geometry geometry(const QRect &rect) const;
+    void updateBlocks();
 
-private slots:
-    void on_menuBtn_clicked();
+    static qint32 blockEnd(const QString &text, qint32 from, qint32 *next);
+    static qint64 utf8Size(QStringView text);
+    static bool isContinuation(QStringView line);
 
 private:
-    Ui::MessageItem *ui;
     ChatSession::MessagePtr mMessage;
-    ChatSession *mSession;
+
+    QString mThink;
+    QString mThinkTail;
+    QString mAvatar;
+    QString mSender;
+    QString mDatetime;
+    QString mStats;
+    QString mStatsToolTip;
+    Qt::LayoutDirection mDirection = Qt::LeftToRight;
+
+    // The content is split into completed markdown blocks and the open
+    // tail after them. While streaming only the tail is decoded, parsed and
+    // laid out. Offsets are in UTF-8 bytes of the message content.
+    QList<Block> mBlocks;
+    qint64 mTailStart = 0;
+    qint64 mContentSize = -1;
+    quint32 mContentRevision = 0;
+    qint32 mContentHeight = 0;
+
+    QTextDocument mThinkDoc;
+    QFont mFont;
+    qint32 mWidth = -1;
+    qint32 mHeight = 0;
+    qint32 mSizedWidth = -1;
+    bool mTextDirty = true;
+    bool mThinkDirty = true;
+    bool mThinkCollapsed = false;
 };
 
 #endif // MESSAGEITEM_H
@@ -0,0 +1,293 @@
+#include "messagesmodel.h"
+#include "messageitem.h"
+#include "modelnames.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+
+#define ITEM_CACHE_CHATS 4
+
+MessagesModel::MessagesModel(ChatSession *session, QObject *parent)
+    : QAbstractListModel{parent}
+    , mSession(session)
+{
+    // Streamed deltas only mark their rows dirty; the rows are refreshed
+    // at most once per display frame.
+    const auto screen = QGuiApplication::primaryScreen();
+    const auto refreshRate = screen? screen->refreshRate() : 60.0;
+
+    mFrameTimer = new QTimer(this);
+    mFrameTimer->setInterval(qMax(1, qRound(1000.0 / (refreshRate > 0? refreshRate : 60.0))));
+    mFrameTimer->setSingleShot(true);
+
+    connect(mFrameTimer, &QTimer::timeout, this, &MessagesModel::flush);
+
+    connect(mSession, &ChatSession::messagesChanged, this, &MessagesModel::reset);
+    connect(mSession, &ChatSession::messagesPrepended, this, &MessagesModel::prepend);
+    connect(mSession, &ChatSession::messagesAppended, this, &MessagesModel::append);
+    connect(mSession, &ChatSession::messageInserted, this, &MessagesModel::insert);
+    connect(mSession, &ChatSession::messageAppended, this, &MessagesModel::markDirty);
+    connect(mSession, &ChatSession::messageRemoved, this, &MessagesModel::remove);
+    connect(mSession, &ChatSession::messageChanged, this, &MessagesModel::markDirty);
+    connect(mSession, &ChatSession::streamFinished, this, &MessagesModel::flush);
+
+    reset();
+}
+
+MessagesModel::~MessagesModel()
+{
+    qDeleteAll(mItems);
+    for (const auto &items: std::as_const(mItemCache))
+        qDeleteAll(items);
+}
+
+int MessagesModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return mMessages.count();
+}
+
+QVariant MessagesModel::data(const QModelIndex &index, int role) const
+{
+    const auto msg = message(index);
+    if (!msg)
+        return QVariant();
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+    case Qt::EditRole:
+        return msg->content.toString();
+    case Qt::ToolTipRole:
+        return ModelNames::name(msg->model);
+    }
+
+    return QVariant();
+}
+
+ChatSession::MessagePtr MessagesModel::message(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.row() < 0 || index.row() >= mMessages.count())
+        return ChatSession::MessagePtr();
+
+    return mMessages.at(index.row());
+}
+
+QModelIndex MessagesModel::indexOf(const ChatSession::MessagePtr &msg) const
+{
+    const auto row = rowOf(msg.get());
+    if (row < 0)
+        return QModelIndex();
+    return index(row);
+}
+
+MessageItem *MessagesModel::item(const QModelIndex &index) const
+{
+    const auto msg = message(index);
+    if (!msg)
+        return nullptr;
+
+    // Items are only created for the rows the view asks about
+    auto &item = mItems[msg.get()];
+    if (!item)
+        item = new MessageItem(msg);
+
+    return item;
+}
+
+MessageItem *MessagesModel::existingItem(const QModelIndex &index) const
+{
+    const auto msg = message(index);
+    if (!msg)
+        return nullptr;
+
+    return mItems.value(msg.get());
+}
+
+bool MessagesModel::isStreaming(const QModelIndex &index) const
+{
+    const auto msg = message(index);
+    return msg && mSession->isStreaming(msg);
+}
+
+void MessagesModel::flush()
+{
+    mFrameTimer->stop();
+    if (mDirty.isEmpty())
+        return;
+
+    const auto dirty = mDirty;
+    mDirty.clear();
+
+    for (const auto msg: dirty)
+    {
+        const auto item = mItems.value(msg);
+        if (item)
+            item->refresh();
+
+        const auto row = rowOf(msg);
+        if (row < 0)
+            continue;
+
+        const auto idx = index(row);
+        Q_EMIT dataChanged(idx, idx);
+    }
+}
+
+void MessagesModel::reset()
+{
+    beginResetModel();
+    mFrameTimer->stop();
+    mDirty.clear();
+
+    // Saved messages are matched by id, unsaved ones only by identity
+    QHash<qint32, MessageItem*> items;
+    QHash<ChatSession::Message*, MessageItem*> unsaved;
+    for (auto i = mItems.constBegin(); i != mItems.constEnd(); i++)
+    {
+        const auto id = i.value()->message()->id;
+        if (id)
+            items.insert(id, i.value());
+        else
+            unsaved.insert(i.key(), i.value());
+    }
+    mItems.clear();
+
+    // Switching back to a recently shown chat reuses its rendered items
+    const auto chatId = mSession->currentChat();
+    if (chatId != mChatId)
+    {
+        if (mChatId && items.count())
+        {
+            mItemCache.insert(mChatId, items);
+            mItemCacheOrder.prepend(mChatId);
+        }
+        else
+            qDeleteAll(items);
+
+        qDeleteAll(unsaved);
+        unsaved.clear();
+
+        items = mItemCache.take(chatId);
+        mItemCacheOrder.removeOne(chatId);
+        while (mItemCacheOrder.count() > ITEM_CACHE_CHATS)
+            qDeleteAll(mItemCache.take(mItemCacheOrder.takeLast()));
+
+        mChatId = chatId;
+    }
+
+    mMessages = mSession->messages();
+    renumber();
+
+    for (const auto &msg: std::as_const(mMessages))
+    {
+        const auto item = msg->id? items.take(msg->id) : unsaved.take(msg.get());
+        if (!item)
+            continue;
+
+        item->setMessage(msg);
+        item->refresh();
+        mItems.insert(msg.get(), item);
+    }
+
+    qDeleteAll(items);
+    qDeleteAll(unsaved);
+
+    endResetModel();
+}
+
+void MessagesModel::prepend(qint32 count)
+{
+    const auto messages = mSession->messages();
+    count = qMin(count, messages.count());
+    if (count <= 0)
+        return;
+
+    beginInsertRows(QModelIndex(), 0, count-1);
+    mMessages = messages.mid(0, count) + mMessages;
+    for (int i=count-1; i>=0; i--)
+        mSeqs[mMessages.at(i).get()] = --mFirstSeq;
+    endInsertRows();
+}
+
+void MessagesModel::append(qint32 count)
+{
+    const auto messages = mSession->messages();
+    count = qMin(count, messages.count());
+    if (count <= 0)
+        return;
+
+    beginInsertRows(QModelIndex(), mMessages.count(), mMessages.count() + count - 1);
+    for (const auto &msg: messages.mid(messages.count() - count))
+    {
+        mSeqs[msg.get()] = mFirstSeq + mMessages.count();
+        mMessages.append(msg);
+    }
+    endInsertRows();
+}
+
+void MessagesModel::insert(const ChatSession::MessagePtr &msg)
+{
+    if (rowOf(msg.get()) >= 0)
+        return;
+
+    beginInsertRows(QModelIndex(), mMessages.count(), mMessages.count());
+    mSeqs[msg.get()] = mFirstSeq + mMessages.count();
+    mMessages.append(msg);
+    endInsertRows();
+}
+
+void MessagesModel::remove(const ChatSession::MessagePtr &msg)
+{
+    const auto row = rowOf(msg.get());
+    if (row < 0)
+        return;
+
+    beginRemoveRows(QModelIndex(), row, row);
+
+    // Renumbers the shorter side, removals are mostly near the end
+    if (row < mMessages.count() / 2)
+    {
+        for (int i=0; i<row; i++)
+            mSeqs[mMessages.at(i).get()]++;
+        mFirstSeq++;
+    }
+    else
+    {
+        for (int i=row+1; i<mMessages.count(); i++)
+            mSeqs[mMessages.at(i).get()]--;
+    }
+    mSeqs.remove(msg.get());
+    mMessages.removeAt(row);
+    mDirty.remove(msg.get());
+    delete mItems.take(msg.get());
+    endRemoveRows();
+}
+
+void MessagesModel::markDirty(const ChatSession::MessagePtr &msg)
+{
+    if (rowOf(msg.get()) < 0)
+        return;
+
+    mDirty.insert(msg.get());
+    if (!mFrameTimer->isActive())
+        mFrameTimer->start();
+}
+
+qint32 MessagesModel::rowOf(ChatSession::Message *msg) const
+{
+    const auto it = mSeqs.constFind(msg);
+    if (it == mSeqs.constEnd())
+        return -1;
+    return qint32(it.value() - mFirstSeq);
+}
+
+void MessagesModel::renumber()
+{
+    mSeqs.clear();
+    mSeqs.reserve(mMessages.count());
+    mFirstSeq = 0;
+    for (int i=0; i<mMessages.count(); i++)
+        mSeqs[mMessages.at(i).get()] = i;
+}
@@ -0,0 +1,66 @@
+#ifndef MESSAGESMODEL_H
+#define MESSAGESMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
+#include "chatsession.h"
+
+class MessageItem;
+class MessagesModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    MessagesModel(ChatSession *session, QObject *parent = nullptr);
+    virtual ~MessagesModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+
+    ChatSession::MessagePtr message(const QModelIndex &index) const;
+    QModelIndex indexOf(const ChatSession::MessagePtr &msg) const;
+    MessageItem *item(const QModelIndex &index) const;
+
+    // The item of a row that has already been shown, without creating one
+    MessageItem *existingItem(const QModelIndex &index) const;
+
+    bool isStreaming(const QModelIndex &index) const;
+
+public Q_SLOTS:
+    void flush();
+
+protected:
+    void reset();
+    void prepend(qint32 count);
+    void append(qint32 count);
+    void insert(const ChatSession::MessagePtr &msg);
+    void remove(const ChatSession::MessagePtr &msg);
+    void markDirty(const ChatSession::MessagePtr &msg);
+    qint32 rowOf(ChatSession::Message *msg) const;
+    void renumber();
+
+private:
+    ChatSession *mSession;
+    QTimer *mFrameTimer;
+
+    QList<ChatSession::MessagePtr> mMessages;
+
+    // Rows are numbered from mFirstSeq on, so a streamed delta finds its
+    // row in constant time. Prepending only moves mFirstSeq.
+    QHash<ChatSession::Message*, qint64> mSeqs;
+    qint64 mFirstSeq = 0;
+    mutable QHash<ChatSession::Message*, MessageItem*> mItems;
+    QSet<ChatSession::Message*> mDirty;
+
+    // Laid out items of the chats shown last by message id, most recent
+    // first. A chat loaded again has new copies of its messages, the items
+    // are moved over to them.
+    qint32 mChatId = 0;
+    QHash<qint32, QHash<qint32, MessageItem*>> mItemCache;
+    QList<qint32> mItemCacheOrder;
+};
+
+#endif // MESSAGESMODEL_H
@@ -1,4 +1,6 @@
 #include "modelmanager.h"
+#include "ndjsonreader.h"
+#include "networkservice.h"
 
 #include <QNetworkRequest>
 #include <QUrl>
@@ -13,7 +15,6 @@ ModelManagerItem::ModelManagerItem(const QString &name, QObject *parent)
     : QObject{parent}
     , mName(name)
 {
-    mAm = new QNetworkAccessManager(this);
 }
 
 ModelManagerItem::~ModelManagerItem()
@@ -23,13 +24,11 @@ ModelManagerItem::~ModelManagerItem()
 
 void ModelManagerItem::start()
 {
-    if (mActiveReply)
+    if (mActiveReply || mWaiting)
         return;
 
     QUrl url(mBaseUrl + "/pull");
 
-    auto buffer = new QByteArray;
-
     QNetworkRequest req;
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     req.setUrl(url);
@@ -37,43 +36,42 @@ void ModelManagerItem::start()
     QJsonObject obj;
     obj["name"] = mName;
 
-    auto reply = mAm->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    // Only a few pulls run at once, the others wait for their turn
+    mWaiting = new QObject(this);
+    NetworkService::instance()->stream(req, QJsonDocument(obj).toJson(QJsonDocument::Compact), mWaiting, [this](QNetworkReply *reply){
+        delete mWaiting;
+        mWaiting = nullptr;
 
-    mActiveReply = reply;
-    connect(reply, &QNetworkReply::readyRead, this, [this, reply, buffer](){
-        const auto data = reply->readAll();
-        buffer->append(data);
-        while (buffer->contains('\n'))
-        {
-            const auto idx = buffer->indexOf('\n');
-            const auto data = buffer->left(idx+1);
-            buffer->remove(0, idx+1);
+        auto reader = new NdjsonReader;
 
-            const auto json = QJsonDocument::fromJson(data);
-            if (!json.isObject())
+        mActiveReply = reply;
+        connect(reply, &QNetworkReply::readyRead, this, [this, reply, reader](){
+            reader->append(reply->readAll());
+
+            QByteArray line;
+            NdjsonReader::Chunk chunk;
+            while (reader->readLine(line))
             {
-                qDebug() << "invalid data:" << data;
-                return;
+                if (!NdjsonReader::parse(line, chunk))
+                {
+                    qDebug() << "invalid data:" << line;
+                    continue;
+                }
+
+                setStatus(chunk.status);
+                setTotal(chunk.total);
+                setDownloaded(chunk.completed);
             }
-
-            const auto obj = json.object();
-            const auto status = obj.value("status").toString();
-            const auto total = obj.value("total").toVariant().toLongLong();
-            const auto completed = obj.value("completed").toVariant().toLongLong();
-
-            setStatus(status);
-            setTotal(total);
-            setDownloaded(completed);
-        }
-    });
-    connect(reply, &QNetworkReply::finished, this, [this, reply](){
-        reply->deleteLater();
-        if (reply == mActiveReply)
-            mActiveReply = nullptr;
-    });
-    connect(reply, &QNetworkReply::destroyed, this, [this, reply, buffer](){
-        delete buffer;
-        Q_EMIT downloadingChanged();
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, reply](){
+            reply->deleteLater();
+            if (reply == mActiveReply)
+                mActiveReply = nullptr;
+        });
+        connect(reply, &QNetworkReply::destroyed, this, [this, reply, reader](){
+            delete reader;
+            Q_EMIT downloadingChanged();
+        });
     });
 
     Q_EMIT downloadingChanged();
@@ -81,6 +79,15 @@ void ModelManagerItem::start()
 
 void ModelManagerItem::stop()
 {
+    if (mWaiting)
+    {
+        delete mWaiting;
+        mWaiting = nullptr;
+        Q_EMIT downloadingChanged();
+        Q_EMIT cancelRequest();
+        return;
+    }
+
     if (!mActiveReply)
         return;
 
@@ -97,7 +104,7 @@ qint64 ModelManagerItem::total() const
 
 bool ModelManagerItem::downloading() const
 {
-    return mActiveReply;
+    return mActiveReply || mWaiting;
 }
 
 void ModelManagerItem::setTotal(qint64 newTotal)
@@ -157,7 +164,6 @@ void ModelManagerItem::setBaseUrl(const QString &newBaseUrl)
 ModelManager::ModelManager(QObject *parent)
     : QObject{parent}
 {
-    mAm = new QNetworkAccessManager(this);
 }
 
 ModelManager::~ModelManager()
@@ -195,11 +201,8 @@ void ModelManager::remove(const QString &name)
     QJsonObject obj;
     obj["name"] = name;
 
-    auto reply = mAm->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact));
-
-    connect(reply, &QNetworkReply::finished, this, [this, reply](){
+    NetworkService::instance()->post(req, QJsonDocument(obj).toJson(QJsonDocument::Compact), this, [this](const QByteArray &, QNetworkReply::NetworkError){
         reload();
-        reply->deleteLater();
     });
 }
 
@@ -211,13 +214,8 @@ void ModelManager::reload()
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     req.setUrl(url);
 
-    auto reply = mAm->get(req);
-
-    connect(reply, &QNetworkReply::finished, this, [this, reply](){
-        const auto data = reply->readAll();
+    NetworkService::instance()->get(req, this, [this](const QByteArray &data, QNetworkReply::NetworkError){
         const auto json = QJsonDocument::fromJson(data);
-        reply->deleteLater();
-
         if (!json.isObject())
         {
             qDebug() << "invalid data:" << data;
@@ -2,7 +2,6 @@
 #define MODELMANAGER_H
 
 #include <QObject>
-#include <QNetworkAccessManager>
 #include <QNetworkReply>
 
 class ModelManagerItem : public QObject
@@ -55,7 +54,9 @@ private:
     QString mBaseUrl;
 
     QNetworkReply *mActiveReply = nullptr;
-    QNetworkAccessManager *mAm;
+
+    // Context of a pull still waiting for its turn, deleting it drops it
+    QObject *mWaiting = nullptr;
 };
 
 
@@ -88,7 +89,6 @@ public Q_SLOTS:
 private:
     QString mBaseUrl;
     QMap<QString, ModelManagerItem*> mItems;
-    QNetworkAccessManager *mAm;
 };
 
 #endif // MODELMANAGER_H
@@ -0,0 +1,42 @@
+#include "modelnames.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QStringList>
+
+namespace {
+
+// Messages are decoded on the storage thread and shown on the GUI thread
+QReadWriteLock gLock;
+QHash<QString, qint32> gIds;
+QStringList gNames = { QString() };
+
+}
+
+qint32 ModelNames::intern(const QString &name)
+{
+    if (name.isEmpty())
+        return 0;
+
+    {
+        QReadLocker locker(&gLock);
+        const auto id = gIds.value(name);
+        if (id)
+            return id;
+    }
+
+    QWriteLocker locker(&gLock);
+    auto &id = gIds[name];
+    if (!id)
+    {
+        id = qint32(gNames.count());
+        gNames << name;
+    }
+    return id;
+}
+
+QString ModelNames::name(qint32 id)
+{
+    QReadLocker locker(&gLock);
+    return gNames.value(id);
+}
@@ -0,0 +1,16 @@
+#ifndef MODELNAMES_H
+#define MODELNAMES_H
+
+#include <QString>
+
+// Process wide table of model names. Messages keep a small id instead of
+// a string of their own, there are only a handful of distinct models.
+// Ids are only valid in this process, the database has its own.
+class ModelNames
+{
+public:
+    static qint32 intern(const QString &name);
+    static QString name(qint32 id);
+};
+
+#endif // MODELNAMES_H
@@ -1,4 +1,5 @@
 #include "modelscombobox.h"
+#include "networkservice.h"
 
 #include <QNetworkRequest>
 #include <QUrl>
@@ -36,7 +37,6 @@ private:
 ModelsComboBox::ModelsComboBox(QWidget *parent)
     : QComboBox{parent}
 {
-    mAm = new QNetworkAccessManager(this);
     // setItemDelegate(new ModelsComboBoxDelegate(this));
 
     setMinimumWidth(180);
@@ -73,15 +73,15 @@ void ModelsComboBox::reload()
     req.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     req.setUrl(url);
 
-    auto reply = mAm->get(req);
-
     clear();
 
-    connect(reply, &QNetworkReply::finished, this, [this, reply](){
-        const auto data = reply->readAll();
-        const auto json = QJsonDocument::fromJson(data);
-        reply->deleteLater();
+    // Every combo box asks at once on startup, they share one request.
+    // Only the answer to the latest reload fills the list.
+    NetworkService::instance()->get(req, this, [this, serial = ++mSerial](const QByteArray &data, QNetworkReply::NetworkError){
+        if (serial != mSerial)
+            return;
 
+        const auto json = QJsonDocument::fromJson(data);
         if (!json.isObject())
         {
             qDebug() << "invalid data:" << data;
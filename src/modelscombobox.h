@@ -2,8 +2,6 @@
 #define MODELSCOMBOBOX_H
 
 #include <QComboBox>
-#include <QNetworkAccessManager>
-#include <QNetworkReply>
 
 class ModelsComboBox : public QComboBox
 {
@@ -30,7 +28,7 @@ public Q_SLOTS:
 private:
     QString mBaseUrl;
     QString mInitialModel;
-    QNetworkAccessManager *mAm;
+    qint32 mSerial = 0;
 };
 
 #endif // MODELSCOMBOBOX_H
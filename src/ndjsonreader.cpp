@@ -0,0 +1,393 @@
+#include "ndjsonreader.h"
+
+#include <QLatin1String>
+
+#include <cstring>
+
+namespace {
+
+class JsonScanner
+{
+public:
+    JsonScanner(const char *begin, const char *end)
+        : p(begin)
+        , e(end)
+    {}
+
+    void skipSpaces()
+    {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+    }
+
+    bool consume(char c)
+    {
+        skipSpaces();
+        if (p >= e || *p != c)
+            return false;
+        p++;
+        return true;
+    }
+
+    bool atEnd()
+    {
+        skipSpaces();
+        return p >= e;
+    }
+
+    bool readKey(QLatin1String &key)
+    {
+        skipSpaces();
+        if (p >= e || *p != '"')
+            return false;
+
+        const auto start = ++p;
+        while (p < e && *p != '"')
+            p += (*p == '\\'? 2 : 1);
+        if (p >= e)
+            return false;
+
+        key = QLatin1String(start, int(p - start));
+        p++;
+        return consume(':');
+    }
+
+    bool readString(QString *out)
+    {
+        skipSpaces();
+        if (p >= e || *p != '"')
+            return skipValue();
+
+        const auto start = ++p;
+        bool escaped = false;
+        while (p < e && *p != '"')
+        {
+            if (*p == '\\')
+            {
+                escaped = true;
+                p += 2;
+            }
+            else
+                p++;
+        }
+        if (p >= e)
+            return false;
+
+        const auto stop = p++;
+        if (!out)
+            return true;
+        if (!escaped)
+        {
+            *out = QString::fromUtf8(start, int(stop - start));
+            return true;
+        }
+        return unescape(start, stop, out);
+    }
+
+    bool readInteger(qint64 *out)
+    {
+        skipSpaces();
+        const auto start = p;
+        const auto negative = (p < e && *p == '-');
+        if (negative)
+            p++;
+
+        qint64 value = 0;
+        const auto digits = p;
+        while (p < e && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        if (p == digits)
+        {
+            p = start;
+            return skipValue();
+        }
+
+        while (p < e && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-'))
+            p++;
+
+        *out = negative? -value : value;
+        return true;
+    }
+
+    bool readBool(bool *out)
+    {
+        skipSpaces();
+        if (e - p >= 4 && std::memcmp(p, "true", 4) == 0)
+        {
+            *out = true;
+            p += 4;
+            return true;
+        }
+        if (e - p >= 5 && std::memcmp(p, "false", 5) == 0)
+        {
+            *out = false;
+            p += 5;
+            return true;
+        }
+        return skipValue();
+    }
+
+    template<typename Handler>
+    bool readObject(Handler handler)
+    {
+        skipSpaces();
+        if (p < e && *p != '{')
+            return skipValue();
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+
+        do
+        {
+            QLatin1String key;
+            if (!readKey(key) || !handler(key))
+                return false;
+        } while (consume(','));
+
+        return consume('}');
+    }
+
+    bool skipValue(int depth = 0)
+    {
+        skipSpaces();
+        if (p >= e || depth > 64)
+            return false;
+
+        switch (*p)
+        {
+        case '"':
+            return readString(nullptr);
+
+        case '{':
+            p++;
+            if (consume('}'))
+                return true;
+            do
+            {
+                QLatin1String key;
+                if (!readKey(key) || !skipValue(depth + 1))
+                    return false;
+            } while (consume(','));
+            return consume('}');
+
+        case '[':
+            p++;
+            if (consume(']'))
+                return true;
+            do
+            {
+                if (!skipValue(depth + 1))
+                    return false;
+            } while (consume(','));
+            return consume(']');
+        }
+
+        const auto start = p;
+        while (p < e && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p++;
+        return p > start;
+    }
+
+protected:
+    static int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    static bool unescape(const char *begin, const char *end, QString *out)
+    {
+        out->clear();
+        out->reserve(int(end - begin));
+
+        auto run = begin;
+        auto i = begin;
+        while (i < end)
+        {
+            if (*i != '\\')
+            {
+                i++;
+                continue;
+            }
+
+            if (i > run)
+                out->append(QString::fromUtf8(run, int(i - run)));
+            if (i + 1 >= end)
+                return false;
+
+            const auto c = i[1];
+            i += 2;
+            switch (c)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                out->append(QLatin1Char(c));
+                break;
+            case 'b':
+                out->append(QLatin1Char('\b'));
+                break;
+            case 'f':
+                out->append(QLatin1Char('\f'));
+                break;
+            case 'n':
+                out->append(QLatin1Char('\n'));
+                break;
+            case 'r':
+                out->append(QLatin1Char('\r'));
+                break;
+            case 't':
+                out->append(QLatin1Char('\t'));
+                break;
+            case 'u':
+            {
+                if (end - i < 4)
+                    return false;
+
+                ushort code = 0;
+                for (int j=0; j<4; j++)
+                {
+                    const auto v = hexValue(i[j]);
+                    if (v < 0)
+                        return false;
+                    code = (code << 4) | v;
+                }
+
+                // Surrogate pairs arrive as two escapes and land as two
+                // UTF-16 code units, so no recombination is needed.
+                out->append(QChar(code));
+                i += 4;
+                break;
+            }
+            default:
+                return false;
+            }
+            run = i;
+        }
+
+        if (i > run)
+            out->append(QString::fromUtf8(run, int(i - run)));
+        return true;
+    }
+
+private:
+    const char *p;
+    const char *e;
+};
+
+}
+
+NdjsonReader::NdjsonReader()
+{
+    mBuffer.reserve(64 * 1024);
+}
+
+void NdjsonReader::append(const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    // Consumed bytes are only dropped when they make up most of the buffer,
+    // so every byte is moved at most once instead of once per line.
+    if (mPos == mBuffer.size())
+    {
+        mBuffer.resize(0);
+        mPos = 0;
+        mScan = 0;
+    }
+    else if (mPos > 4096 && mPos * 2 > mBuffer.size())
+    {
+        mBuffer.remove(0, mPos);
+        mScan -= mPos;
+        mPos = 0;
+    }
+
+    mBuffer.append(data);
+}
+
+bool NdjsonReader::readLine(QByteArray &line, bool flush)
+{
+    while (mPos < mBuffer.size())
+    {
+        const auto data = mBuffer.constData();
+        const auto newline = static_cast<const char*>(std::memchr(data + mScan, '\n', mBuffer.size() - mScan));
+
+        qsizetype end;
+        if (newline)
+            end = newline - data;
+        else if (flush)
+            end = mBuffer.size();
+        else
+        {
+            mScan = mBuffer.size();
+            return false;
+        }
+
+        const auto start = mPos;
+        auto length = end - start;
+        mPos = qMin<qsizetype>(end + 1, mBuffer.size());
+        mScan = mPos;
+
+        if (length && data[start + length - 1] == '\r')
+            length--;
+        if (length == 0)
+            continue;
+
+        line = QByteArray::fromRawData(data + start, int(length));
+        return true;
+    }
+
+    return false;
+}
+
+bool NdjsonReader::parse(const QByteArray &line, Chunk &chunk)
+{
+    chunk = Chunk();
+
+    JsonScanner s(line.constData(), line.constData() + line.size());
+    const auto res = s.readObject([&](const QLatin1String &key) -> bool {
+        if (key == QLatin1String("message"))
+            return s.readObject([&](const QLatin1String &key) -> bool {
+                if (key == QLatin1String("content"))
+                    return s.readString(&chunk.content);
+                if (key == QLatin1String("thinking"))
+                    return s.readString(&chunk.thinking);
+                if (key == QLatin1String("role"))
+                    return s.readString(&chunk.role);
+                return s.skipValue();
+            });
+        if (key == QLatin1String("model"))
+            return s.readString(&chunk.model);
+        if (key == QLatin1String("done"))
+            return s.readBool(&chunk.done);
+        if (key == QLatin1String("status"))
+            return s.readString(&chunk.status);
+        if (key == QLatin1String("completed"))
+            return s.readInteger(&chunk.completed);
+        if (key == QLatin1String("total"))
+            return s.readInteger(&chunk.total);
+        if (key == QLatin1String("total_duration"))
+            return s.readInteger(&chunk.totalDuration);
+        if (key == QLatin1String("load_duration"))
+            return s.readInteger(&chunk.loadDuration);
+        if (key == QLatin1String("eval_count"))
+            return s.readInteger(&chunk.evalCount);
+        if (key == QLatin1String("eval_duration"))
+            return s.readInteger(&chunk.evalDuration);
+        if (key == QLatin1String("prompt_eval_count"))
+            return s.readInteger(&chunk.promptEvalCount);
+        if (key == QLatin1String("prompt_eval_duration"))
+            return s.readInteger(&chunk.promptEvalDuration);
+        if (key == QLatin1String("error"))
+            return s.readString(&chunk.error);
+        return s.skipValue();
+    });
+
+    return res && s.atEnd();
+}
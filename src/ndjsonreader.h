@@ -0,0 +1,44 @@
+#ifndef NDJSONREADER_H
+#define NDJSONREADER_H
+
+#include <QByteArray>
+#include <QString>
+
+class NdjsonReader
+{
+public:
+    struct Chunk {
+        QString model;
+        QString role;
+        QString content;
+        QString thinking;
+        QString status;
+        QString error;
+        qint64 completed = 0;
+        qint64 total = 0;
+        qint64 totalDuration = 0;
+        qint64 loadDuration = 0;
+        qint64 promptEvalCount = 0;
+        qint64 promptEvalDuration = 0;
+        qint64 evalCount = 0;
+        qint64 evalDuration = 0;
+        bool done = false;
+    };
+
+    NdjsonReader();
+
+    void append(const QByteArray &data);
+
+    // The returned line is a view into the internal buffer and stays
+    // valid until the next call to append().
+    bool readLine(QByteArray &line, bool flush = false);
+
+    static bool parse(const QByteArray &line, Chunk &chunk);
+
+private:
+    QByteArray mBuffer;
+    qsizetype mPos = 0;
+    qsizetype mScan = 0;
+};
+
+#endif // NDJSONREADER_H
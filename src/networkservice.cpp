@@ -0,0 +1,224 @@
+#include "networkservice.h"
+
+#include <QCoreApplication>
+#include <QUrl>
+#include <QDebug>
+
+#define NETWORK_DEFAULT_LIMIT 4
+#define NETWORK_INTERACTIVE_SLOTS 1
+
+NetworkService::NetworkService(QObject *parent)
+    : QObject{parent}
+{
+    mAm = new QNetworkAccessManager(this);
+
+    // Indexing embeddings keep the server busy, they are sent one by one
+    // and a search or a prompt only waits for the batch already running.
+    // Pulls are long running streams, they should not take all the
+    // connections.
+    mLimits["/api/embed"] = 1;
+    mLimits["/api/pull"] = 2;
+}
+
+NetworkService::~NetworkService()
+{
+}
+
+NetworkService *NetworkService::instance()
+{
+    // Owned by the application, so it goes away before the network stack
+    static QPointer<NetworkService> service;
+    if (!service)
+        service = new NetworkService(QCoreApplication::instance());
+    return service;
+}
+
+QNetworkReply *NetworkService::post(const QNetworkRequest &req, const QByteArray &body)
+{
+    auto reply = mAm->post(req, body);
+    track(reply, req.url().path());
+    return reply;
+}
+
+void NetworkService::get(const QNetworkRequest &req, QObject *context, const Callback &callback)
+{
+    // Everyone asking for the same url while it is on its way gets the
+    // same answer
+    const auto key = req.url().toEncoded();
+    const auto pending = mInFlight.value(key);
+    if (pending)
+    {
+        pending->waiters.append({context, callback});
+        mTimings[pending->endpoint].coalesced++;
+        return;
+    }
+
+    auto p = PendingPtr::create();
+    p->operation = QNetworkAccessManager::GetOperation;
+    p->request = req;
+    p->endpoint = req.url().path();
+    p->key = key;
+    p->waiters.append({context, callback});
+    mInFlight[key] = p;
+    enqueue(p);
+}
+
+void NetworkService::post(const QNetworkRequest &req, const QByteArray &body, QObject *context, const Callback &callback, Priority priority)
+{
+    auto p = PendingPtr::create();
+    p->operation = QNetworkAccessManager::PostOperation;
+    p->request = req;
+    p->body = body;
+    p->endpoint = req.url().path();
+    p->waiters.append({context, callback});
+    p->priority = priority;
+    enqueue(p);
+}
+
+void NetworkService::stream(const QNetworkRequest &req, const QByteArray &body, QObject *context, const Started &started)
+{
+    auto p = PendingPtr::create();
+    p->operation = QNetworkAccessManager::PostOperation;
+    p->request = req;
+    p->body = body;
+    p->endpoint = req.url().path();
+    p->waiters.append({context, Callback()});
+    p->started = started;
+    p->priority = Background;
+    enqueue(p);
+}
+
+qint32 NetworkService::limit(const QString &endpoint) const
+{
+    return mLimits.value(endpoint, NETWORK_DEFAULT_LIMIT);
+}
+
+void NetworkService::setLimit(const QString &endpoint, qint32 limit)
+{
+    mLimits[endpoint] = qMax(1, limit);
+
+    // A raised limit lets waiting requests go right away
+    dequeue(endpoint);
+}
+
+QHash<QString, NetworkService::Timing> NetworkService::timings() const
+{
+    return mTimings;
+}
+
+void NetworkService::enqueue(const PendingPtr &pending)
+{
+    pending->queued.start();
+    auto &queue = mQueues[pending->endpoint];
+    if (queue.isEmpty() && canStart(pending))
+    {
+        start(pending);
+        return;
+    }
+
+    // Interactive requests queue up after each other, but before all the
+    // background ones
+    auto i = queue.begin();
+    if (pending->priority == Interactive)
+        while (i != queue.end() && (*i)->priority == Interactive)
+            i++;
+    else
+        i = queue.end();
+    queue.insert(i, pending);
+
+    // An interactive request can have a free slot the background ones
+    // ahead of it couldn't use
+    dequeue(pending->endpoint);
+}
+
+void NetworkService::dequeue(const QString &endpoint)
+{
+    // Starting a request may queue others, the queue is looked up again.
+    // Interactive requests are in front, when the first one can't start
+    // nothing behind it can.
+    while (true)
+    {
+        auto &queue = mQueues[endpoint];
+        if (queue.isEmpty() || !canStart(queue.first()))
+            return;
+
+        const auto pending = queue.takeFirst();
+
+        // Nobody is left to read a stream whose owner went away
+        if (pending->started && !pending->waiters.first().context)
+            continue;
+
+        start(pending);
+    }
+}
+
+bool NetworkService::canStart(const PendingPtr &pending) const
+{
+    const auto running = mRunning.value(pending->endpoint);
+    const auto max = limit(pending->endpoint) + (pending->priority == Interactive? NETWORK_INTERACTIVE_SLOTS : 0);
+    return running < max;
+}
+
+void NetworkService::start(const PendingPtr &pending)
+{
+    mTimings[pending->endpoint].queuedTime += pending->queued.elapsed();
+
+    if (pending->started)
+    {
+        const auto reply = mAm->post(pending->request, pending->body);
+        track(reply, pending->endpoint);
+        pending->started(reply);
+        return;
+    }
+
+    QNetworkReply *reply;
+    if (pending->operation == QNetworkAccessManager::GetOperation)
+        reply = mAm->get(pending->request);
+    else
+        reply = mAm->post(pending->request, pending->body);
+    track(reply, pending->endpoint);
+
+    connect(reply, &QNetworkReply::finished, this, [this, reply, pending](){
+        reply->deleteLater();
+        if (pending->key.count())
+            mInFlight.remove(pending->key);
+
+        const auto data = reply->readAll();
+        const auto error = reply->error();
+        for (const auto &w: std::as_const(pending->waiters))
+            if (w.context)
+                w.callback(data, error);
+    });
+}
+
+void NetworkService::track(QNetworkReply *reply, const QString &endpoint)
+{
+    mRunning[endpoint]++;
+
+    // Replies are released when they finish, or when they are deleted
+    // by their owner without finishing
+    auto released = QSharedPointer<bool>::create(false);
+    const auto release = [this, endpoint, released](){
+        if (*released)
+            return;
+        *released = true;
+
+        mRunning[endpoint]--;
+        dequeue(endpoint);
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    connect(reply, &QNetworkReply::finished, this, [this, reply, endpoint, timer, release](){
+        const auto elapsed = timer.elapsed();
+        auto &t = mTimings[endpoint];
+        t.requests++;
+        t.totalTime += elapsed;
+        t.maxTime = qMax(t.maxTime, elapsed);
+        if (reply->error() != QNetworkReply::NoError && reply->error() != QNetworkReply::OperationCanceledError)
+            t.failures++;
+        release();
+        Q_EMIT timingsChanged();
+    });
+    connect(reply, &QObject::destroyed, this, release);
+}
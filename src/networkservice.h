@@ -0,0 +1,110 @@
+#ifndef NETWORKSERVICE_H
+#define NETWORKSERVICE_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QHash>
+
+#include <functional>
+
+// One network access manager for the whole process, so every request to
+// the server shares its pool of kept alive connections.
+//
+// Requests wait while their endpoint is at its limit. Those that only need
+// the whole answer go through a callback, and identical GETs in flight are
+// sent once. Streams get their reply once they are sent. Chat answers are
+// the one exception, the user is waiting on them, so they go right away.
+//
+// Requests the user is waiting for go before the background ones queued
+// for the same endpoint, and get one slot over the limit, so they never
+// wait for more than the requests already running.
+class NetworkService : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<void(const QByteArray &data, QNetworkReply::NetworkError error)> Callback;
+    typedef std::function<void(QNetworkReply *reply)> Started;
+
+    enum Priority {
+        Interactive,
+        Background
+    };
+
+    struct Timing
+    {
+        qint32 requests = 0;
+        qint32 failures = 0;
+        qint32 coalesced = 0;
+        qint64 totalTime = 0;
+        qint64 maxTime = 0;
+        qint64 queuedTime = 0;
+    };
+
+    static NetworkService *instance();
+
+    // Sent right away, only counted against the limit
+    QNetworkReply *post(const QNetworkRequest &req, const QByteArray &body);
+
+    void get(const QNetworkRequest &req, QObject *context, const Callback &callback);
+    void post(const QNetworkRequest &req, const QByteArray &body, QObject *context, const Callback &callback, Priority priority = Interactive);
+
+    // A background stream that is dropped if the context is gone before
+    // its turn
+    void stream(const QNetworkRequest &req, const QByteArray &body, QObject *context, const Started &started);
+
+    // Endpoints are url paths like "/api/tags"
+    qint32 limit(const QString &endpoint) const;
+    void setLimit(const QString &endpoint, qint32 limit);
+
+    QHash<QString, Timing> timings() const;
+
+Q_SIGNALS:
+    void timingsChanged();
+
+protected:
+    NetworkService(QObject *parent = nullptr);
+    virtual ~NetworkService();
+
+    struct Waiter
+    {
+        QPointer<QObject> context;
+        Callback callback;
+    };
+
+    struct Pending
+    {
+        QNetworkAccessManager::Operation operation;
+        QNetworkRequest request;
+        QByteArray body;
+        QString endpoint;
+        QByteArray key;
+        QList<Waiter> waiters;
+        Started started;
+        Priority priority = Interactive;
+        QElapsedTimer queued;
+    };
+    typedef QSharedPointer<Pending> PendingPtr;
+
+    void enqueue(const PendingPtr &pending);
+    void dequeue(const QString &endpoint);
+    bool canStart(const PendingPtr &pending) const;
+    void start(const PendingPtr &pending);
+    void track(QNetworkReply *reply, const QString &endpoint);
+
+private:
+    QNetworkAccessManager *mAm;
+
+    QHash<QByteArray, PendingPtr> mInFlight;
+    QHash<QString, QList<PendingPtr>> mQueues;
+    QHash<QString, qint32> mRunning;
+    QHash<QString, qint32> mLimits;
+    QHash<QString, Timing> mTimings;
+};
+
+#endif // NETWORKSERVICE_H
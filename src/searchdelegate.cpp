@@ -0,0 +1,65 @@
+#include "searchdelegate.h"
+
+#include <QAbstractScrollArea>
+#include <QAbstractTextDocumentLayout>
+#include <QApplication>
+#include <QPainter>
+#include <QTextDocument>
+#include <QtMath>
+
+#define RESULT_PADDING 4
+
+SearchDelegate::SearchDelegate(QObject *parent)
+    : QStyledItemDelegate{parent}
+{
+}
+
+SearchDelegate::~SearchDelegate()
+{
+}
+
+void SearchDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+
+    // The background and selection come from the style, the highlighted
+    // snippet is drawn on top of it.
+    opt.text.clear();
+    const auto style = opt.widget? opt.widget->style() : QApplication::style();
+    style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, opt.widget);
+
+    QTextDocument doc;
+    prepare(doc, option, index);
+
+    QAbstractTextDocumentLayout::PaintContext ctx;
+    ctx.palette = opt.palette;
+    if (opt.state & QStyle::State_Selected)
+        ctx.palette.setColor(QPalette::Text, opt.palette.color(QPalette::HighlightedText));
+
+    painter->save();
+    painter->translate(opt.rect.topLeft() + QPoint(RESULT_PADDING, RESULT_PADDING));
+    painter->setClipRect(QRect(QPoint(0, 0), opt.rect.size() - QSize(RESULT_PADDING, RESULT_PADDING)));
+    doc.documentLayout()->draw(painter, ctx);
+    painter->restore();
+}
+
+QSize SearchDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    // Results wrap to the width of the list, not of the current rect
+    auto opt = option;
+    if (const auto area = qobject_cast<const QAbstractScrollArea*>(option.widget))
+        opt.rect.setWidth(area->viewport()->width());
+
+    QTextDocument doc;
+    prepare(doc, opt, index);
+    return QSize(opt.rect.width(), qCeil(doc.size().height()) + RESULT_PADDING * 2);
+}
+
+void SearchDelegate::prepare(QTextDocument &doc, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    doc.setDocumentMargin(0);
+    doc.setDefaultFont(option.font);
+    doc.setTextWidth(qMax(0, option.rect.width() - RESULT_PADDING * 2));
+    doc.setHtml(index.data(Qt::DisplayRole).toString());
+}
@@ -0,0 +1,22 @@
+#ifndef SEARCHDELEGATE_H
+#define SEARCHDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+class QTextDocument;
+class SearchDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    SearchDelegate(QObject *parent = nullptr);
+    virtual ~SearchDelegate();
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const Q_DECL_OVERRIDE;
+
+protected:
+    void prepare(QTextDocument &doc, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+};
+
+#endif // SEARCHDELEGATE_H
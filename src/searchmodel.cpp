@@ -0,0 +1,229 @@
+#include "searchmodel.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QRegularExpression>
+#include <QDebug>
+
+#define SEARCH_DELAY 200
+#define SEARCH_LIMIT 100
+
+// Control characters can't show up in stored text, so the highlight
+// markers survive HTML escaping and are replaced afterwards.
+#define MATCH_OPEN "\x01"
+#define MATCH_CLOSE "\x02"
+
+SearchModel::SearchModel(StorageService *storage, QObject *parent)
+    : QAbstractListModel{parent}
+    , mStorage(storage)
+{
+    mSearchTimer = new QTimer(this);
+    mSearchTimer->setInterval(SEARCH_DELAY);
+    mSearchTimer->setSingleShot(true);
+
+    connect(mSearchTimer, &QTimer::timeout, this, &SearchModel::search);
+}
+
+SearchModel::~SearchModel()
+{
+}
+
+int SearchModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return mResults.count();
+}
+
+QVariant SearchModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= mResults.count())
+        return QVariant();
+
+    const auto &r = mResults.at(index.row());
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        if (r.snippet.isEmpty())
+            return r.chat;
+        return QStringLiteral("<b>%1</b><br>%2").arg(r.chat, r.snippet);
+    case ChatIdRole:
+        return r.chatId;
+    case MessageIdRole:
+        return r.messageId;
+    }
+
+    return QVariant();
+}
+
+QString SearchModel::query() const
+{
+    return mQuery;
+}
+
+void SearchModel::setQuery(const QString &newQuery)
+{
+    if (mQuery == newQuery)
+        return;
+
+    mQuery = newQuery;
+    mSearchTimer->start();
+    Q_EMIT queryChanged();
+}
+
+bool SearchModel::semantic() const
+{
+    return mSemantic;
+}
+
+void SearchModel::setSemantic(bool newSemantic)
+{
+    if (mSemantic == newSemantic)
+        return;
+
+    mSemantic = newSemantic;
+    mSearchTimer->start();
+    Q_EMIT semanticChanged();
+}
+
+void SearchModel::setEmbeddingIndex(EmbeddingIndex *index)
+{
+    mIndex = index;
+}
+
+void SearchModel::search()
+{
+    const auto serial = ++mSerial;
+    const auto match = matchExpression(mQuery);
+    if (match.isEmpty())
+    {
+        beginResetModel();
+        mResults.clear();
+        endResetModel();
+        return;
+    }
+
+    if (mSemantic && mIndex)
+    {
+        searchSemantic(serial);
+        return;
+    }
+
+    // Message and chat name hits are ranked together by bm25, lower is better
+    mStorage->read(this, [match](QSqlDatabase &db){
+        QList<Result> res;
+
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        q.prepare("SELECT m.chat_id, m.id, c.name, snippet(messages_fts, 0, '" MATCH_OPEN "', '" MATCH_CLOSE "', '…', 16), bm25(messages_fts) AS rank "
+                  "FROM messages_fts JOIN messages m ON m.id = messages_fts.rowid JOIN chats c ON c.id = m.chat_id "
+                  "WHERE messages_fts MATCH :match "
+                  "UNION ALL "
+                  "SELECT c.id, 0, highlight(chats_fts, 0, '" MATCH_OPEN "', '" MATCH_CLOSE "'), '', bm25(chats_fts) AS rank "
+                  "FROM chats_fts JOIN chats c ON c.id = chats_fts.rowid "
+                  "WHERE chats_fts MATCH :match "
+                  "ORDER BY rank LIMIT :limit");
+        q.bindValue(":match", match);
+        q.bindValue(":limit", SEARCH_LIMIT);
+        if (!q.exec())
+        {
+            qDebug() << q.lastError();
+            return res;
+        }
+
+        while (q.next())
+        {
+            Result r;
+            r.chatId = q.value(0).toInt();
+            r.messageId = q.value(1).toInt();
+            r.chat = highlight(q.value(2).toString());
+            r.snippet = highlight(q.value(3).toString().simplified());
+            res << r;
+        }
+
+        return res;
+    }, [this, serial](const QList<Result> &results){
+        if (serial != mSerial)
+            return;
+
+        beginResetModel();
+        mResults = results;
+        endResetModel();
+    });
+}
+
+void SearchModel::searchSemantic(qint32 serial)
+{
+    // The index only knows message ids, chats and texts of the closest
+    // messages are read afterwards in the order of their scores.
+    mIndex->search(mQuery, SEARCH_LIMIT, this, [this, serial](const QList<EmbeddingIndex::Hit> &hits){
+        if (serial != mSerial)
+            return;
+
+        QVector<qint32> ids;
+        for (const auto &hit: hits)
+            ids << hit.messageId;
+
+        mStorage->read(this, [ids](QSqlDatabase &db){
+            QList<Result> res;
+            if (ids.isEmpty())
+                return res;
+
+            QStringList list;
+            for (const auto id: ids)
+                list << QString::number(id);
+
+            QSqlQuery q(db);
+            q.setForwardOnly(true);
+            if (!q.exec(QStringLiteral("SELECT m.id, m.chat_id, c.name, substr(m.content, 1, 240) FROM messages m JOIN chats c ON c.id = m.chat_id WHERE m.id IN (%1)").arg(list.join(','))))
+            {
+                qDebug() << q.lastError();
+                return res;
+            }
+
+            QHash<qint32, Result> found;
+            while (q.next())
+            {
+                Result r;
+                r.messageId = q.value(0).toInt();
+                r.chatId = q.value(1).toInt();
+                r.chat = q.value(2).toString().toHtmlEscaped();
+                r.snippet = q.value(3).toString().simplified().toHtmlEscaped();
+                found[r.messageId] = r;
+            }
+
+            for (const auto id: ids)
+                if (found.contains(id))
+                    res << found.value(id);
+
+            return res;
+        }, [this, serial](const QList<Result> &results){
+            if (serial != mSerial)
+                return;
+
+            beginResetModel();
+            mResults = results;
+            endResetModel();
+        });
+    });
+}
+
+QString SearchModel::matchExpression(const QString &query)
+{
+    // Every word is matched as a quoted prefix, so FTS5 operators typed
+    // into the search box are taken literally.
+    static const QRegularExpression re(QStringLiteral("[^\\w]+"), QRegularExpression::UseUnicodePropertiesOption);
+
+    QStringList terms;
+    for (const auto &word: query.split(re, Qt::SkipEmptyParts))
+        terms << QStringLiteral("\"%1\"*").arg(word);
+
+    return terms.join(' ');
+}
+
+QString SearchModel::highlight(const QString &text)
+{
+    return text.toHtmlEscaped()
+        .replace(QStringLiteral(MATCH_OPEN), QStringLiteral("<b>"))
+        .replace(QStringLiteral(MATCH_CLOSE), QStringLiteral("</b>"));
+}
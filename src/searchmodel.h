@@ -0,0 +1,66 @@
+#ifndef SEARCHMODEL_H
+#define SEARCHMODEL_H
+
+#include <QAbstractListModel>
+#include <QTimer>
+
+#include "storageservice.h"
+#include "embeddingindex.h"
+
+class SearchModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged FINAL)
+    Q_PROPERTY(bool semantic READ semantic WRITE setSemantic NOTIFY semanticChanged FINAL)
+
+public:
+    enum Roles {
+        ChatIdRole = Qt::UserRole + 1,
+        MessageIdRole,
+    };
+
+    SearchModel(StorageService *storage, QObject *parent = nullptr);
+    virtual ~SearchModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+
+    QString query() const;
+    void setQuery(const QString &newQuery);
+
+    bool semantic() const;
+    void setSemantic(bool newSemantic);
+
+    void setEmbeddingIndex(EmbeddingIndex *index);
+
+Q_SIGNALS:
+    void queryChanged();
+    void semanticChanged();
+
+protected:
+    void search();
+    void searchSemantic(qint32 serial);
+    static QString matchExpression(const QString &query);
+    static QString highlight(const QString &text);
+
+private:
+    StorageService *mStorage;
+    EmbeddingIndex *mIndex = nullptr;
+    QTimer *mSearchTimer;
+
+    QString mQuery;
+    bool mSemantic = false;
+    qint32 mSerial = 0;
+
+    struct Result
+    {
+        qint32 chatId = 0;
+        qint32 messageId = 0;
+        QString chat;
+        QString snippet;
+    };
+
+    QList<Result> mResults;
+};
+
+#endif // SEARCHMODEL_H
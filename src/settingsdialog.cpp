@@ -15,6 +15,16 @@ SettingsDialog::SettingsDialog(QSettings *settings, QWidget *parent)
 
     ui->ollamaHost->setText( mSettings->value("Ollama/host", "localhost").toString() );
     ui->ollamaPort->setValue( mSettings->value("Ollama/port", 11434).toInt() );
+    ui->ollamaKeepAlive->setText( mSettings->value("Ollama/keepAlive").toString() );
+    ui->contextBudget->setValue( mSettings->value("Context/budget", 4096).toInt() );
+    ui->contextCompaction->setChecked( mSettings->value("Context/compaction", false).toBool() );
+    ui->contextPrefixStable->setChecked( mSettings->value("Context/prefixStable", false).toBool() );
+    ui->embeddingModel->setText( mSettings->value("Search/embeddingModel").toString() );
+    ui->deterministic->setChecked( mSettings->value("Sampling/deterministic", false).toBool() );
+    ui->seed->setValue( mSettings->value("Sampling/seed", mSettings->value("Cache/seed", 0)).toInt() );
+    ui->cacheEnabled->setChecked( mSettings->value("Cache/enabled", false).toBool() );
+    ui->cacheEnabled->setEnabled( ui->deterministic->isChecked() );
+    ui->cacheSize->setValue( mSettings->value("Cache/sizeLimit", 64).toInt() );
 
     mModelManager = new ModelManager(this);
 
@@ -91,6 +101,15 @@ void SettingsDialog::accept()
 {
     mSettings->setValue("Ollama/host", ui->ollamaHost->text());
     mSettings->setValue("Ollama/port", ui->ollamaPort->value());
+    mSettings->setValue("Ollama/keepAlive", ui->ollamaKeepAlive->text().trimmed());
+    mSettings->setValue("Context/budget", ui->contextBudget->value());
+    mSettings->setValue("Context/compaction", ui->contextCompaction->isChecked());
+    mSettings->setValue("Context/prefixStable", ui->contextPrefixStable->isChecked());
+    mSettings->setValue("Search/embeddingModel", ui->embeddingModel->text().trimmed());
+    mSettings->setValue("Sampling/deterministic", ui->deterministic->isChecked());
+    mSettings->setValue("Sampling/seed", ui->seed->value());
+    mSettings->setValue("Cache/enabled", ui->cacheEnabled->isChecked());
+    mSettings->setValue("Cache/sizeLimit", ui->cacheSize->value());
 
     QDialog::accept();
 }
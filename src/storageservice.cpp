@@ -0,0 +1,503 @@
+#include "storageservice.h"
+#include "thinksplitter.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QCryptographicHash>
+#include <QTimer>
+#include <QDebug>
+
+#define DATABASE_VERSION 13
+#define STORAGE_COMMIT_INTERVAL 300
+
+StorageService::StorageService(QObject *parent)
+    : QObject{parent}
+{
+    mThread = new QThread(this);
+    mThread->setObjectName("storage");
+
+    mWorker = new QObject;
+    mWorker->moveToThread(mThread);
+    connect(mThread, &QThread::finished, mWorker, &QObject::deleteLater);
+
+    mThread->start();
+}
+
+StorageService::~StorageService()
+{
+    close();
+
+    mThread->quit();
+    mThread->wait();
+}
+
+QString StorageService::fileLocation() const
+{
+    return mFileLocation;
+}
+
+void StorageService::open(const QString &fileLocation)
+{
+    if (mFileLocation == fileLocation)
+        return;
+
+    close();
+
+    mFileLocation = fileLocation;
+    mConnection = mFileLocation.isEmpty()? QString() : QString::fromLatin1(QCryptographicHash::hash(mFileLocation.toUtf8(), QCryptographicHash::Sha256).toBase64());
+    Q_EMIT fileLocationChanged();
+
+    if (mConnection.isEmpty())
+        return;
+
+    mOpenMutex.lock();
+    mOpening = true;
+    mOpenMutex.unlock();
+
+    const auto connection = mConnection;
+    const auto file = mFileLocation;
+    QMetaObject::invokeMethod(mWorker, [this, connection, file](){
+        mWorkerConnection = connection;
+
+        if (!mCommitTimer)
+        {
+            mCommitTimer = new QTimer(mWorker);
+            mCommitTimer->setInterval(STORAGE_COMMIT_INTERVAL);
+            mCommitTimer->setSingleShot(true);
+            connect(mCommitTimer, &QTimer::timeout, mWorker, [this](){ commit(); });
+        }
+
+        auto db = QSqlDatabase::addDatabase("QSQLITE", connection);
+        db.setDatabaseName(file);
+
+        auto res = db.open();
+        if (res)
+            res = initDatabase(db);
+        else
+            qDebug() << db.lastError();
+
+        QSqlQuery q(db);
+        if (res && q.exec("SELECT (SELECT IFNULL(MAX(id), 0) FROM chats), (SELECT IFNULL(MAX(id), 0) FROM messages)") && q.next())
+        {
+            mLastChatId.storeRelease(q.value(0).toInt());
+            mLastMessageId.storeRelease(q.value(1).toInt());
+        }
+
+        mOpenMutex.lock();
+        mOpening = false;
+        mOpenCondition.wakeAll();
+        mOpenMutex.unlock();
+
+        Q_EMIT opened(res);
+    }, Qt::QueuedConnection);
+}
+
+void StorageService::close()
+{
+    if (mConnection.isEmpty())
+        return;
+
+    const auto connection = mConnection;
+    mConnection.clear();
+    mFileLocation.clear();
+
+    // Closing waits for the queued jobs, so nothing written is lost
+    QMetaObject::invokeMethod(mWorker, [this, connection](){
+        commit();
+        mWorkerConnection.clear();
+
+        QSqlDatabase::database(connection).close();
+        QSqlDatabase::removeDatabase(connection);
+    }, Qt::BlockingQueuedConnection);
+}
+
+void StorageService::write(const Job &job)
+{
+    enqueue(job, true);
+}
+
+qint32 StorageService::nextChatId()
+{
+    waitForOpen();
+    return mLastChatId.fetchAndAddOrdered(1) + 1;
+}
+
+qint32 StorageService::nextMessageId()
+{
+    waitForOpen();
+    return mLastMessageId.fetchAndAddOrdered(1) + 1;
+}
+
+void StorageService::enqueue(const Job &job, bool write)
+{
+    if (mConnection.isEmpty())
+        return;
+
+    const auto connection = mConnection;
+    QMetaObject::invokeMethod(mWorker, [this, connection, job, write](){
+        auto db = QSqlDatabase::database(connection, false);
+        if (!db.isOpen())
+            return;
+
+        if (write)
+            begin();
+        job(db);
+    }, Qt::QueuedConnection);
+}
+
+void StorageService::waitForOpen()
+{
+    QMutexLocker locker(&mOpenMutex);
+    while (mOpening)
+        mOpenCondition.wait(&mOpenMutex);
+}
+
+void StorageService::begin()
+{
+    // Writes are grouped into one transaction per commit interval, and the
+    // commit itself runs here instead of blocking the GUI thread.
+    if (mInTransaction)
+        return;
+
+    auto db = QSqlDatabase::database(mWorkerConnection, false);
+    if (!db.isOpen())
+        return;
+
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN"))
+    {
+        qDebug() << q.lastError();
+        return;
+    }
+
+    mInTransaction = true;
+    mCommitTimer->start();
+}
+
+void StorageService::commit()
+{
+    if (!mInTransaction)
+        return;
+
+    mCommitTimer->stop();
+    mInTransaction = false;
+
+    auto db = QSqlDatabase::database(mWorkerConnection, false);
+    if (!db.isOpen())
+        return;
+
+    QSqlQuery q(db);
+    if (!q.exec("COMMIT"))
+        qDebug() << q.lastError();
+}
+
+bool StorageService::initDatabase(QSqlDatabase &db)
+{
+    // These are per connection and have to run outside of a transaction.
+    // foreign_keys is only turned on after the migrations, as rebuilding a
+    // table would otherwise cascade into the tables referring to it.
+    const QStringList pragmas = {
+        "PRAGMA journal_mode=WAL",
+        "PRAGMA synchronous=NORMAL",
+        "PRAGMA foreign_keys=OFF",
+        "PRAGMA cache_size=-16384",
+        "PRAGMA mmap_size=268435456",
+        "PRAGMA temp_store=MEMORY",
+    };
+    for (const auto &p: pragmas)
+    {
+        QSqlQuery q(db);
+        if (!q.exec(p))
+            qDebug() << q.lastError();
+    }
+
+    const auto version = getValue(db, "version", "0").toInt();
+    QStringList queries;
+    switch (version)
+    {
+    case 0:
+        queries << R"(CREATE TABLE "chats" (
+                      "id" INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+                      "name" TEXT NOT NULL,
+                      "datetime" INTEGER NOT NULL
+                    ))";
+        queries << R"(CREATE TABLE "general" (
+                      "_key" TEXT NOT NULL,
+                      "_value" TEXT NOT NULL,
+                      PRIMARY KEY ("_key")
+                    ))";
+        queries << R"(CREATE TABLE "messages" (
+                      "id" INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+                      "chat_id" INTEGER NOT NULL,
+                      "model" TEXT NOT NULL,
+                      "role" TEXT NOT NULL,
+                      "content" TEXT NOT NULL,
+                      "datetime" INTEGER NOT NULL,
+                      CONSTRAINT "messages_chat_id_frgkey" FOREIGN KEY ("chat_id") REFERENCES "chats" ("id") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        Q_FALLTHROUGH();
+    case 1:
+        queries << R"(CREATE TABLE "chat_summaries" (
+                      "chat_id" INTEGER NOT NULL PRIMARY KEY,
+                      "message_id" INTEGER NOT NULL,
+                      "content" TEXT NOT NULL,
+                      CONSTRAINT "chat_summaries_chat_id_frgkey" FOREIGN KEY ("chat_id") REFERENCES "chats" ("id") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        Q_FALLTHROUGH();
+    case 2:
+        queries << R"(CREATE TABLE "message_stats" (
+                      "message_id" INTEGER NOT NULL PRIMARY KEY,
+                      "total_duration" INTEGER NOT NULL DEFAULT 0,
+                      "load_duration" INTEGER NOT NULL DEFAULT 0,
+                      "prompt_eval_count" INTEGER NOT NULL DEFAULT 0,
+                      "prompt_eval_duration" INTEGER NOT NULL DEFAULT 0,
+                      "eval_count" INTEGER NOT NULL DEFAULT 0,
+                      "eval_duration" INTEGER NOT NULL DEFAULT 0,
+                      "time_to_first_byte" INTEGER NOT NULL DEFAULT -1,
+                      "time_to_first_token" INTEGER NOT NULL DEFAULT -1,
+                      CONSTRAINT "message_stats_message_id_frgkey" FOREIGN KEY ("message_id") REFERENCES "messages" ("id") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        Q_FALLTHROUGH();
+    case 3:
+        queries << R"(CREATE INDEX IF NOT EXISTS "messages_chat_id_idx" ON "messages" ("chat_id", "id"))";
+        Q_FALLTHROUGH();
+    case 4:
+        queries << R"(ALTER TABLE "messages" ADD COLUMN "reasoning" TEXT NOT NULL DEFAULT '')";
+        Q_FALLTHROUGH();
+    case 5:
+        queries << R"(ALTER TABLE "messages" ADD COLUMN "partial" INTEGER NOT NULL DEFAULT 0)";
+        Q_FALLTHROUGH();
+    case 6:
+        // External content tables, the text itself is only stored once
+        queries << R"(CREATE VIRTUAL TABLE "messages_fts" USING fts5("content", content='messages', content_rowid='id'))";
+        queries << R"(CREATE TRIGGER "messages_fts_insert" AFTER INSERT ON "messages" BEGIN
+                      INSERT INTO "messages_fts" (rowid, "content") VALUES (new."id", new."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_delete" AFTER DELETE ON "messages" BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") VALUES ('delete', old."id", old."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_update" AFTER UPDATE OF "content" ON "messages" BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") VALUES ('delete', old."id", old."content");
+                      INSERT INTO "messages_fts" (rowid, "content") VALUES (new."id", new."content");
+                    END)";
+        queries << R"(CREATE VIRTUAL TABLE "chats_fts" USING fts5("name", content='chats', content_rowid='id'))";
+        queries << R"(CREATE TRIGGER "chats_fts_insert" AFTER INSERT ON "chats" BEGIN
+                      INSERT INTO "chats_fts" (rowid, "name") VALUES (new."id", new."name");
+                    END)";
+        queries << R"(CREATE TRIGGER "chats_fts_delete" AFTER DELETE ON "chats" BEGIN
+                      INSERT INTO "chats_fts" ("chats_fts", rowid, "name") VALUES ('delete', old."id", old."name");
+                    END)";
+        queries << R"(CREATE TRIGGER "chats_fts_update" AFTER UPDATE OF "name" ON "chats" BEGIN
+                      INSERT INTO "chats_fts" ("chats_fts", rowid, "name") VALUES ('delete', old."id", old."name");
+                      INSERT INTO "chats_fts" (rowid, "name") VALUES (new."id", new."name");
+                    END)";
+        queries << R"(INSERT INTO "messages_fts" ("messages_fts") VALUES ('rebuild'))";
+        queries << R"(INSERT INTO "chats_fts" ("chats_fts") VALUES ('rebuild'))";
+        Q_FALLTHROUGH();
+    case 7:
+        queries << R"(CREATE TABLE "message_embeddings" (
+                      "message_id" INTEGER NOT NULL PRIMARY KEY,
+                      "model" TEXT NOT NULL,
+                      "vector" BLOB NOT NULL,
+                      CONSTRAINT "message_embeddings_message_id_frgkey" FOREIGN KEY ("message_id") REFERENCES "messages" ("id") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        queries << R"(CREATE TRIGGER "message_embeddings_update" AFTER UPDATE OF "content" ON "messages" BEGIN
+                      DELETE FROM "message_embeddings" WHERE "message_id" = new."id";
+                    END)";
+        Q_FALLTHROUGH();
+    case 8:
+        queries << R"(CREATE TABLE "chat_sources" (
+                      "chat_id" INTEGER NOT NULL,
+                      "path" TEXT NOT NULL,
+                      PRIMARY KEY ("chat_id", "path"),
+                      CONSTRAINT "chat_sources_chat_id_frgkey" FOREIGN KEY ("chat_id") REFERENCES "chats" ("id") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        queries << R"(CREATE TABLE "document_files" (
+                      "path" TEXT NOT NULL PRIMARY KEY,
+                      "size" INTEGER NOT NULL,
+                      "mtime" INTEGER NOT NULL,
+                      "model" TEXT NOT NULL
+                    ))";
+        queries << R"(CREATE TABLE "document_chunks" (
+                      "path" TEXT NOT NULL,
+                      "start" INTEGER NOT NULL,
+                      "length" INTEGER NOT NULL,
+                      "hash" BLOB NOT NULL,
+                      CONSTRAINT "document_chunks_path_frgkey" FOREIGN KEY ("path") REFERENCES "document_files" ("path") ON DELETE CASCADE ON UPDATE CASCADE
+                    ))";
+        queries << R"(CREATE INDEX "document_chunks_path_idx" ON "document_chunks" ("path"))";
+        queries << R"(CREATE TABLE "chunk_embeddings" (
+                      "hash" BLOB NOT NULL,
+                      "model" TEXT NOT NULL,
+                      "vector" BLOB NOT NULL,
+                      PRIMARY KEY ("hash", "model")
+                    ) WITHOUT ROWID)";
+        Q_FALLTHROUGH();
+    case 9:
+        queries << R"(CREATE TABLE "response_cache" (
+                      "key" BLOB NOT NULL PRIMARY KEY,
+                      "model" TEXT NOT NULL,
+                      "data" BLOB NOT NULL,
+                      "size" INTEGER NOT NULL,
+                      "used_at" INTEGER NOT NULL
+                    ) WITHOUT ROWID)";
+        queries << R"(CREATE INDEX "response_cache_used_at_idx" ON "response_cache" ("used_at"))";
+        Q_FALLTHROUGH();
+    case 10:
+        // Model names are stored once and roles as numbers, see
+        // ChatSession::Role. The table is rebuilt to drop the text columns.
+        queries << R"(CREATE TABLE "models" (
+                      "id" INTEGER NOT NULL PRIMARY KEY,
+                      "name" TEXT NOT NULL UNIQUE
+                    ))";
+        queries << R"(INSERT INTO "models" ("name") SELECT DISTINCT "model" FROM "messages")";
+        queries << R"(CREATE TABLE "messages_new" (
+                      "id" INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+                      "chat_id" INTEGER NOT NULL,
+                      "model_id" INTEGER NOT NULL,
+                      "role" INTEGER NOT NULL,
+                      "content" TEXT NOT NULL,
+                      "reasoning" TEXT NOT NULL DEFAULT '',
+                      "datetime" INTEGER NOT NULL,
+                      "partial" INTEGER NOT NULL DEFAULT 0,
+                      CONSTRAINT "messages_chat_id_frgkey" FOREIGN KEY ("chat_id") REFERENCES "chats" ("id") ON DELETE CASCADE ON UPDATE CASCADE,
+                      CONSTRAINT "messages_model_id_frgkey" FOREIGN KEY ("model_id") REFERENCES "models" ("id")
+                    ))";
+        queries << R"(INSERT INTO "messages_new" ("id", "chat_id", "model_id", "role", "content", "reasoning", "datetime", "partial")
+                      SELECT m."id", m."chat_id", d."id", CASE m."role" WHEN 'user' THEN 0 WHEN 'assistant' THEN 1 WHEN 'system' THEN 2 ELSE 3 END,
+                             m."content", m."reasoning", m."datetime", m."partial"
+                      FROM "messages" m JOIN "models" d ON d."name" = m."model")";
+        queries << R"(DROP TABLE "messages")";
+        queries << R"(ALTER TABLE "messages_new" RENAME TO "messages")";
+        queries << R"(CREATE INDEX "messages_chat_id_idx" ON "messages" ("chat_id", "id"))";
+        queries << R"(CREATE TRIGGER "messages_fts_insert" AFTER INSERT ON "messages" BEGIN
+                      INSERT INTO "messages_fts" (rowid, "content") VALUES (new."id", new."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_delete" AFTER DELETE ON "messages" BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") VALUES ('delete', old."id", old."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_update" AFTER UPDATE OF "content" ON "messages" BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") VALUES ('delete', old."id", old."content");
+                      INSERT INTO "messages_fts" (rowid, "content") VALUES (new."id", new."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "message_embeddings_update" AFTER UPDATE OF "content" ON "messages" BEGIN
+                      DELETE FROM "message_embeddings" WHERE "message_id" = new."id";
+                    END)";
+        Q_FALLTHROUGH();
+    case 11:
+        // The chat list is paged by last activity
+        queries << R"(ALTER TABLE "chats" ADD COLUMN "updated_at" INTEGER NOT NULL DEFAULT 0)";
+        queries << R"(UPDATE "chats" SET "updated_at" = MAX("datetime", IFNULL((SELECT MAX("datetime") FROM "messages" WHERE "chat_id" = "chats"."id"), 0)))";
+        queries << R"(CREATE INDEX "chats_updated_at_idx" ON "chats" ("updated_at", "id"))";
+        queries << R"(CREATE TRIGGER "chats_updated_at_insert" AFTER INSERT ON "messages" BEGIN
+                      UPDATE "chats" SET "updated_at" = new."datetime" WHERE "id" = new."chat_id" AND "updated_at" < new."datetime";
+                    END)";
+        Q_FALLTHROUGH();
+    case 12:
+        // A streaming answer is upserted on every checkpoint. It is only
+        // indexed once it is final, so its text is tokenized once.
+        queries << R"(DROP TRIGGER "messages_fts_insert")";
+        queries << R"(DROP TRIGGER "messages_fts_delete")";
+        queries << R"(DROP TRIGGER "messages_fts_update")";
+        queries << R"(DROP TRIGGER "message_embeddings_update")";
+        queries << R"(INSERT INTO "messages_fts" ("messages_fts", rowid, "content") SELECT 'delete', "id", "content" FROM "messages" WHERE "partial" = 1)";
+        queries << R"(CREATE TRIGGER "messages_fts_insert" AFTER INSERT ON "messages" WHEN new."partial" = 0 BEGIN
+                      INSERT INTO "messages_fts" (rowid, "content") VALUES (new."id", new."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_delete" AFTER DELETE ON "messages" WHEN old."partial" = 0 BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") VALUES ('delete', old."id", old."content");
+                    END)";
+        queries << R"(CREATE TRIGGER "messages_fts_update" AFTER UPDATE OF "content", "partial" ON "messages" BEGIN
+                      INSERT INTO "messages_fts" ("messages_fts", rowid, "content") SELECT 'delete', old."id", old."content" WHERE old."partial" = 0;
+                      INSERT INTO "messages_fts" (rowid, "content") SELECT new."id", new."content" WHERE new."partial" = 0;
+                    END)";
+        queries << R"(CREATE TRIGGER "message_embeddings_update" AFTER UPDATE OF "content" ON "messages" WHEN old."partial" = 0 BEGIN
+                      DELETE FROM "message_embeddings" WHERE "message_id" = new."id";
+                    END)";
+        break;
+    }
+
+    begin();
+    for (const auto &t: queries)
+    {
+        QSqlQuery q(db);
+        if (!q.exec(t))
+            qDebug() << q.lastError();
+    }
+
+    if (version > 0 && version < 5)
+        migrateReasoning(db);
+
+    if (queries.size())
+        setValue(db, "version", QString::number(DATABASE_VERSION));
+
+    commit();
+
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA foreign_keys=ON"))
+        qDebug() << q.lastError();
+
+    return true;
+}
+
+void StorageService::migrateReasoning(QSqlDatabase &db)
+{
+    // Older answers kept the think tags inside their content. They are
+    // split once here, so the stream parser is the only place doing it.
+    // It runs after all migrations, the role is a number by then.
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT id, content FROM messages WHERE role <> 0 AND (content LIKE '%<think>%' OR content LIKE '%</think>%' OR content LIKE '%</response>%')");
+    if (!q.exec())
+    {
+        qDebug() << q.lastError();
+        return;
+    }
+
+    QSqlQuery update(db);
+    update.prepare("UPDATE messages SET content=:content, reasoning=:reasoning WHERE id=:id");
+    while (q.next())
+    {
+        QString content;
+        QString reasoning;
+        ThinkSplitter::split(q.value(1).toString(), content, reasoning);
+
+        update.bindValue(":id", q.value(0));
+        update.bindValue(":content", content);
+        update.bindValue(":reasoning", reasoning);
+        if (!update.exec())
+            qDebug() << update.lastError();
+    }
+}
+
+QString StorageService::getValue(QSqlDatabase &db, const QString &key, const QString &defaultValue)
+{
+    QSqlQuery q(db);
+    q.prepare("SELECT _value FROM general WHERE _key = :key");
+    q.bindValue(":key", key);
+    if (!q.exec())
+    {
+        qDebug() << q.lastError();
+        return defaultValue;
+    }
+
+    if (!q.next())
+        return defaultValue;
+
+    return q.record().value(0).toString();
+}
+
+bool StorageService::setValue(QSqlDatabase &db, const QString &key, const QString &value)
+{
+    QSqlQuery q(db);
+    q.prepare("INSERT OR REPLACE INTO general (_key, _value) VALUES (:key, :value)");
+    q.bindValue(":key", key);
+    q.bindValue(":value", value);
+    if (!q.exec())
+    {
+        qDebug() << q.lastError();
+        return false;
+    }
+    return true;
+}
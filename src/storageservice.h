@@ -0,0 +1,93 @@
+#ifndef STORAGESERVICE_H
+#define STORAGESERVICE_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QPointer>
+#include <QSqlDatabase>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
+#include <utility>
+
+class QTimer;
+class StorageService : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString fileLocation READ fileLocation NOTIFY fileLocationChanged FINAL)
+
+public:
+    typedef std::function<void(QSqlDatabase &db)> Job;
+
+    StorageService(QObject *parent = nullptr);
+    virtual ~StorageService();
+
+    QString fileLocation() const;
+
+    void open(const QString &fileLocation);
+    void close();
+
+    // Jobs run one after the other on the storage thread in the order they
+    // were queued, so a read always sees the writes queued before it.
+    void write(const Job &job);
+
+    template<typename Func, typename Callback>
+    void read(QObject *context, Func job, Callback callback)
+    {
+        typedef decltype(job(std::declval<QSqlDatabase&>())) Result;
+
+        QPointer<QObject> guard(context);
+        enqueue([this, guard, job, callback](QSqlDatabase &db){
+            auto res = job(db);
+            QMetaObject::invokeMethod(this, [guard, callback, res = std::move(res)](){
+                if (guard)
+                    callback(res);
+            }, Qt::QueuedConnection);
+        }, false);
+    }
+
+    // Row ids are handed out here instead of by SQLite, so rows can refer
+    // to each other before their inserts have reached the database.
+    qint32 nextChatId();
+    qint32 nextMessageId();
+
+    static QString getValue(QSqlDatabase &db, const QString &key, const QString &defaultValue = QString());
+    static bool setValue(QSqlDatabase &db, const QString &key, const QString &value);
+
+Q_SIGNALS:
+    void fileLocationChanged();
+    void opened(bool success);
+
+protected:
+    void enqueue(const Job &job, bool write);
+    void waitForOpen();
+
+    bool initDatabase(QSqlDatabase &db);
+    void migrateReasoning(QSqlDatabase &db);
+
+    void begin();
+    void commit();
+
+private:
+    QThread *mThread;
+    QObject *mWorker;
+
+    QString mFileLocation;
+    QString mConnection;
+
+    // Only touched on the storage thread
+    QString mWorkerConnection;
+    QTimer *mCommitTimer = nullptr;
+    bool mInTransaction = false;
+
+    QMutex mOpenMutex;
+    QWaitCondition mOpenCondition;
+    bool mOpening = false;
+
+    QAtomicInt mLastChatId;
+    QAtomicInt mLastMessageId;
+};
+
+#endif // STORAGESERVICE_H
@@ -0,0 +1,152 @@
+#include "textrope.h"
+
+#define ROPE_CHUNK_SIZE 4096
+
+TextRope::TextRope()
+{
+}
+
+TextRope::TextRope(const QString &text)
+{
+    append(text);
+}
+
+TextRope &TextRope::operator=(const QString &text)
+{
+    clear();
+    append(text);
+    return *this;
+}
+
+TextRope &TextRope::operator+=(QStringView text)
+{
+    append(text);
+    return *this;
+}
+
+void TextRope::append(QStringView text)
+{
+    if (text.isEmpty())
+        return;
+
+    const auto data = text.toUtf8();
+    mSize += data.size();
+
+    qsizetype pos = 0;
+    while (pos < data.size())
+    {
+        if (mChunks.isEmpty() || mChunks.last().size() >= ROPE_CHUNK_SIZE)
+        {
+            if (mChunks.count())
+                mChunks.last().squeeze();
+            mChunks.append(QByteArray());
+        }
+
+        // A character that does not fit anymore starts the next chunk
+        auto end = qMin<qsizetype>(data.size(), pos + ROPE_CHUNK_SIZE - mChunks.last().size());
+        while (end > pos && end < data.size() && (uchar(data.at(end)) & 0xc0) == 0x80)
+            end--;
+        if (end == pos)
+        {
+            mChunks.last().squeeze();
+            mChunks.append(QByteArray());
+            continue;
+        }
+
+        mChunks.last().append(data.constData() + pos, int(end - pos));
+        pos = end;
+    }
+}
+
+void TextRope::clear()
+{
+    if (mChunks.isEmpty())
+        return;
+
+    mChunks.clear();
+    mSize = 0;
+    mRevision++;
+}
+
+void TextRope::chopTrailingSpaces()
+{
+    auto chopped = false;
+    while (mChunks.count())
+    {
+        auto &chunk = mChunks.last();
+        if (chunk.isEmpty())
+        {
+            mChunks.removeLast();
+            continue;
+        }
+
+        // Finds the start of the last character to check it as a whole
+        auto start = chunk.size() - 1;
+        while (start > 0 && (uchar(chunk.at(start)) & 0xc0) == 0x80)
+            start--;
+
+        const auto ch = QString::fromUtf8(chunk.constData() + start, chunk.size() - start);
+        if (ch.isEmpty() || !ch.at(0).isSpace())
+            break;
+
+        mSize -= chunk.size() - start;
+        chunk.truncate(start);
+        chopped = true;
+    }
+
+    if (chopped)
+        mRevision++;
+}
+
+bool TextRope::isEmpty() const
+{
+    return mSize == 0;
+}
+
+qint64 TextRope::size() const
+{
+    return mSize;
+}
+
+quint32 TextRope::revision() const
+{
+    return mRevision;
+}
+
+const QList<QByteArray> &TextRope::chunks() const
+{
+    return mChunks;
+}
+
+QString TextRope::toString(qint64 from) const
+{
+    QString res;
+    if (from >= mSize)
+        return res;
+
+    res.reserve(int(mSize - from));
+    for (const auto &chunk: mChunks)
+    {
+        if (from >= chunk.size())
+        {
+            from -= chunk.size();
+            continue;
+        }
+
+        res += QString::fromUtf8(chunk.constData() + from, int(chunk.size() - from));
+        from = 0;
+    }
+    return res;
+}
+
+QByteArray TextRope::toUtf8() const
+{
+    if (mChunks.count() == 1)
+        return mChunks.first();
+
+    QByteArray res;
+    res.reserve(int(mSize));
+    for (const auto &chunk: mChunks)
+        res += chunk;
+    return res;
+}
@@ -0,0 +1,47 @@
+#ifndef TEXTROPE_H
+#define TEXTROPE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringView>
+
+// Text kept as UTF-8 in chunks of bounded size. Appending never moves what
+// is already stored, and copies share their chunks, so a checkpoint of a
+// streaming answer only copies the last chunk once it grows again. Every
+// chunk holds whole characters and can be decoded on its own.
+class TextRope
+{
+public:
+    TextRope();
+    TextRope(const QString &text);
+
+    TextRope &operator=(const QString &text);
+    TextRope &operator+=(QStringView text);
+
+    void append(QStringView text);
+    void clear();
+    void chopTrailingSpaces();
+
+    bool isEmpty() const;
+
+    // Size in UTF-8 bytes
+    qint64 size() const;
+
+    // Changes whenever the text changes other than by appending
+    quint32 revision() const;
+
+    const QList<QByteArray> &chunks() const;
+
+    // Decodes the text from the given byte offset on, which must be at a
+    // character boundary
+    QString toString(qint64 from = 0) const;
+    QByteArray toUtf8() const;
+
+private:
+    QList<QByteArray> mChunks;
+    qint64 mSize = 0;
+    quint32 mRevision = 0;
+};
+
+#endif // TEXTROPE_H
@@ -0,0 +1,135 @@
+#include "thinksplitter.h"
+
+#include <QStringView>
+
+namespace {
+
+const QLatin1String kOpenTag("<think>");
+const QLatin1String kCloseTags[] = {
+    QLatin1String("</think>"),
+    QLatin1String("</response>"),
+};
+
+}
+
+ThinkSplitter::ThinkSplitter()
+{
+}
+
+void ThinkSplitter::feed(const QString &delta, TextRope &answer, QString &reasoning)
+{
+    QString buffer;
+    if (mPending.count())
+    {
+        buffer = mPending + delta;
+        mPending.clear();
+    }
+    else
+        buffer = delta;
+
+    const QStringView text(buffer);
+    qsizetype pos = 0;
+    while (pos < text.size())
+    {
+        const auto lt = text.indexOf(QLatin1Char('<'), pos);
+        if (lt < 0)
+        {
+            output(text.mid(pos), answer, reasoning);
+            return;
+        }
+
+        output(text.mid(pos, lt - pos), answer, reasoning);
+
+        const auto rest = text.mid(lt);
+        if (rest.startsWith(kOpenTag))
+        {
+            mState = Think;
+            pos = lt + kOpenTag.size();
+            continue;
+        }
+
+        auto closed = false;
+        auto partial = kOpenTag.startsWith(rest);
+        for (const auto &tag: kCloseTags)
+        {
+            if (rest.startsWith(tag))
+            {
+                // A closing tag without an opening one means the model
+                // started in reasoning mode, so all of the answer so far
+                // was reasoning.
+                if (mState == Answer)
+                {
+                    reasoning += answer.toString();
+                    answer.clear();
+                }
+
+                while (reasoning.count() && reasoning.at(reasoning.count()-1).isSpace())
+                    reasoning.chop(1);
+
+                mState = Answer;
+                pos = lt + tag.size();
+                closed = true;
+                break;
+            }
+
+            partial = partial || tag.startsWith(rest);
+        }
+        if (closed)
+            continue;
+
+        if (partial)
+        {
+            mPending = rest.toString();
+            return;
+        }
+
+        output(rest.left(1), answer, reasoning);
+        pos = lt + 1;
+    }
+}
+
+void ThinkSplitter::finish(TextRope &answer, QString &reasoning)
+{
+    if (mPending.count())
+    {
+        output(mPending, answer, reasoning);
+        mPending.clear();
+    }
+
+    answer.chopTrailingSpaces();
+    while (reasoning.count() && reasoning.at(reasoning.count()-1).isSpace())
+        reasoning.chop(1);
+}
+
+bool ThinkSplitter::thinking() const
+{
+    return mState == Think;
+}
+
+void ThinkSplitter::split(const QString &text, QString &answer, QString &reasoning)
+{
+    TextRope rope;
+    ThinkSplitter splitter;
+    splitter.feed(text, rope, reasoning);
+    splitter.finish(rope, reasoning);
+    answer = rope.toString();
+}
+
+void ThinkSplitter::output(const QStringView &text, TextRope &answer, QString &reasoning)
+{
+    const auto thinking = (mState == Think);
+
+    // Leading white space of both parts is dropped as it arrives
+    auto part = text;
+    if (thinking? reasoning.isEmpty() : answer.isEmpty())
+        while (part.size() && part.at(0).isSpace())
+            part = part.mid(1);
+
+    if (part.isEmpty())
+        return;
+
+    if (thinking)
+        reasoning.append(part.data(), int(part.size()));
+    else
+        answer.append(part);
+}
@@ -0,0 +1,35 @@
+#ifndef THINKSPLITTER_H
+#define THINKSPLITTER_H
+
+#include <QString>
+
+#include "textrope.h"
+
+class ThinkSplitter
+{
+public:
+    ThinkSplitter();
+
+    // Routes a streamed delta into the answer and reasoning buffers. Tags
+    // split across deltas are held back until the next call.
+    void feed(const QString &delta, TextRope &answer, QString &reasoning);
+    void finish(TextRope &answer, QString &reasoning);
+
+    bool thinking() const;
+
+    static void split(const QString &text, QString &answer, QString &reasoning);
+
+protected:
+    void output(const QStringView &text, TextRope &answer, QString &reasoning);
+
+private:
+    enum State {
+        Answer,
+        Think
+    };
+
+    State mState = Answer;
+    QString mPending;
+};
+
+#endif // THINKSPLITTER_H
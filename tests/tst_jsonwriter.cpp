@@ -0,0 +1,225 @@
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "jsonwriter.h"
+
+// Same as in textrope.cpp
+#define ROPE_CHUNK_SIZE 4096
+
+class JsonWriterTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void nesting();
+    void numbersAndFlags();
+    void escapes();
+    void controlCharacters();
+    void unicode();
+    void loneSurrogates();
+    void ropeMatchesString();
+    void ropeChunkBoundaries();
+
+private:
+    static QByteArray encode(const QString &text);
+    static QByteArray encode(const TextRope &text);
+    static QString parse(const QByteArray &json);
+};
+
+QByteArray JsonWriterTest::encode(const QString &text)
+{
+    QByteArray res;
+    JsonWriter::escape(res, text);
+    return res;
+}
+
+QByteArray JsonWriterTest::encode(const TextRope &text)
+{
+    QByteArray res;
+    JsonWriter::escape(res, text);
+    return res;
+}
+
+QString JsonWriterTest::parse(const QByteArray &json)
+{
+    // Wrapped in an object, a bare string is not a JSON document for Qt 5
+    QJsonParseError error;
+    const auto doc = QJsonDocument::fromJson("{\"s\":" + json + "}", &error);
+    if (error.error != QJsonParseError::NoError)
+        return QStringLiteral("<%1>").arg(error.errorString());
+    return doc.object().value(QStringLiteral("s")).toString();
+}
+
+void JsonWriterTest::nesting()
+{
+    QByteArray out;
+    JsonWriter w(out);
+    w.beginObject();
+    w.key("model");
+    w.value(QStringLiteral("llama3.2"));
+    w.key("messages");
+    w.beginArray();
+    w.beginObject();
+    w.key("role");
+    w.value(QStringLiteral("user"));
+    w.endObject();
+    w.beginObject();
+    w.endObject();
+    w.beginArray();
+    w.endArray();
+    w.raw("{\"cached\":[1,2]}");
+    w.endArray();
+    w.key("options");
+    w.raw("{}");
+    w.key("stream");
+    w.value(true);
+    w.endObject();
+
+    QCOMPARE(out, QByteArray(R"({"model":"llama3.2","messages":[{"role":"user"},{},[],{"cached":[1,2]}],"options":{},"stream":true})"));
+    QVERIFY(!QJsonDocument::fromJson(out).isNull());
+
+    // Writing goes on after what is in the buffer already
+    QByteArray prefix = "[1,";
+    JsonWriter tail(prefix);
+    tail.value(2);
+    tail.endArray();
+    QCOMPARE(prefix, QByteArray("[1,2]"));
+}
+
+void JsonWriterTest::numbersAndFlags()
+{
+    QByteArray out;
+    JsonWriter w(out);
+    w.beginArray();
+    w.value(qint32(0));
+    w.value(qint32(-42));
+    w.value(std::numeric_limits<qint32>::max());
+    w.value(std::numeric_limits<qint64>::min());
+    w.value(Q_INT64_C(79123456789));
+    w.value(false);
+    w.value(true);
+    w.endArray();
+
+    QCOMPARE(out, QByteArray("[0,-42,2147483647,-9223372036854775808,79123456789,false,true]"));
+}
+
+void JsonWriterTest::escapes()
+{
+    QCOMPARE(encode(QString()), QByteArray("\"\""));
+    QCOMPARE(encode(QStringLiteral("plain text")), QByteArray("\"plain text\""));
+    QCOMPARE(encode(QStringLiteral("say \"hi\"")), QByteArray(R"("say \"hi\"")"));
+    QCOMPARE(encode(QStringLiteral("C:\\dir\\")), QByteArray(R"("C:\\dir\\")"));
+    QCOMPARE(encode(QStringLiteral("a\nb\rc\td\be\f")), QByteArray(R"("a\nb\rc\td\be\f")"));
+
+    // Slashes and DEL need no escape
+    QCOMPARE(encode(QStringLiteral("</think>\x7f")), QByteArray("\"</think>\x7f\""));
+
+    const auto text = QStringLiteral("{\"nested\": \"json\\n\"}\n");
+    QCOMPARE(parse(encode(text)), text);
+}
+
+void JsonWriterTest::controlCharacters()
+{
+    // Everything below a space is escaped, most of it as \u00XX
+    for (ushort c=0; c<0x20; c++)
+    {
+        const auto text = QStringLiteral("x") + QChar(c) + QStringLiteral("y");
+        const auto json = encode(text);
+        for (const auto b: json)
+            QVERIFY(uchar(b) >= 0x20);
+        QCOMPARE(parse(json), text);
+    }
+
+    QCOMPARE(encode(QString(QChar(0x01))), QByteArray(R"("\u0001")"));
+    QCOMPARE(encode(QString(QChar(0x1f))), QByteArray(R"("\u001f")"));
+    QCOMPARE(encode(QString(QChar(0x00))), QByteArray(R"("\u0000")"));
+}
+
+void JsonWriterTest::unicode()
+{
+    // Two, three and four byte UTF-8, written raw
+    const auto text = QString::fromUtf8("caf\xc3\xa9 \xe2\x9c\x93 \xf0\x9f\x98\x80 \xd8\xb3\xd9\x84\xd8\xa7\xd9\x85");
+    QCOMPARE(encode(text), '"' + text.toUtf8() + '"');
+    QCOMPARE(parse(encode(text)), text);
+
+    // The edges of each encoding length
+    const QList<uint> codepoints = {0x7f, 0x80, 0x7ff, 0x800, 0xd7ff, 0xe000, 0xfffd, 0x10000, 0x10fffd};
+    for (const auto cp: codepoints)
+    {
+        const auto ch = QString::fromUcs4(reinterpret_cast<const char32_t *>(&cp), 1);
+        QCOMPARE(encode(ch), '"' + ch.toUtf8() + '"');
+    }
+}
+
+void JsonWriterTest::loneSurrogates()
+{
+    // Never valid UTF-8, they become replacement characters
+    const auto replacement = QByteArray("\xef\xbf\xbd");
+
+    QString high = QStringLiteral("a");
+    high += QChar(0xd83d);
+    high += QStringLiteral("b");
+    QCOMPARE(encode(high), "\"a" + replacement + "b\"");
+
+    QString low;
+    low += QChar(0xde00);
+    QCOMPARE(encode(low), '"' + replacement + '"');
+
+    // A high surrogate at the very end has nothing to pair with
+    QString end = QStringLiteral("z");
+    end += QChar(0xd83d);
+    QCOMPARE(encode(end), "\"z" + replacement + '"');
+}
+
+void JsonWriterTest::ropeMatchesString()
+{
+    const QList<QString> samples = {
+        QString(),
+        QStringLiteral("plain"),
+        QStringLiteral("say \"hi\" \\ back"),
+        QStringLiteral("a\nb\rc\td\be\f\x01\x1f end"),
+        QString::fromUtf8("caf\xc3\xa9 \xe2\x9c\x93 \xf0\x9f\x98\x80"),
+        QStringLiteral("\"\\\""),
+    };
+    for (const auto &text: samples)
+    {
+        QCOMPARE(encode(TextRope(text)), encode(text));
+
+        QByteArray out;
+        JsonWriter w(out);
+        w.beginArray();
+        w.value(TextRope(text));
+        w.value(text);
+        w.endArray();
+        QCOMPARE(out, '[' + encode(text) + ',' + encode(text) + ']');
+    }
+}
+
+void JsonWriterTest::ropeChunkBoundaries()
+{
+    // Escapes and multi byte characters right at the chunk ends, the runs
+    // copied between escapes must not leak over from one chunk to the next
+    const QList<QString> tails = {
+        QStringLiteral("\"\"\\"),
+        QStringLiteral("\n\t"),
+        QString::fromUtf8("\xf0\x9f\x98\x80\"x"),
+        QString::fromUtf8("\xc3\xa9\\"),
+    };
+    for (const auto &tail: tails)
+    {
+        for (int before=ROPE_CHUNK_SIZE-3; before<=ROPE_CHUNK_SIZE; before++)
+        {
+            const auto text = QString(before, QLatin1Char('a')) + tail + QString(before, QLatin1Char('b')) + tail;
+            const TextRope rope(text);
+            QVERIFY(rope.chunks().count() > 1);
+
+            const auto json = encode(rope);
+            QCOMPARE(json, encode(text));
+            QCOMPARE(parse(json), text);
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(JsonWriterTest)
+#include "tst_jsonwriter.moc"
@@ -0,0 +1,295 @@
+#include <QtTest>
+
+#include "ndjsonreader.h"
+
+// Size of the pieces the stream is fed in, about one TCP segment
+#define STREAM_PIECE_SIZE 1400
+#define STREAM_TOKENS 50000
+
+class NdjsonReaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void splitAcrossAppends();
+    void crlf();
+    void emptyLines();
+    void flushFinalLine();
+    void compaction();
+    void escapedQuotes();
+    void unicodeEscapes();
+    void rawUtf8();
+    void numbersAndFlags();
+    void unknownKeys();
+    void invalidLines();
+
+    void benchmarkStream();
+
+private:
+    static QList<QByteArray> readAll(NdjsonReader &reader, bool flush = false);
+
+    QByteArray mStream;
+};
+
+QList<QByteArray> NdjsonReaderTest::readAll(NdjsonReader &reader, bool flush)
+{
+    // Lines are views into the reader, they are copied before the next append
+    QList<QByteArray> res;
+    QByteArray line;
+    while (reader.readLine(line, flush))
+        res << QByteArray(line.constData(), line.size());
+    return res;
+}
+
+void NdjsonReaderTest::initTestCase()
+{
+    // Shaped like a chat answer streamed by Ollama, one token per line and
+    // the statistics in the last one
+    const QList<QByteArray> tokens = {"The", " quick", " brown", " fox", " jumps", " over", " the", " lazy", " dog", ".", "\\n", " \\\"Quoted\\\"", " caf\\u00e9"};
+    for (int i=0; i<STREAM_TOKENS; i++)
+    {
+        mStream += R"({"model":"llama3.2:latest","created_at":"2024-11-02T10:15:42.123456Z","message":{"role":"assistant","content":")";
+        mStream += tokens.at(i % tokens.count());
+        mStream += R"("},"done":false})";
+        mStream += '\n';
+    }
+    mStream += R"({"model":"llama3.2:latest","created_at":"2024-11-02T10:17:01.654321Z","message":{"role":"assistant","content":""},)"
+               R"("done_reason":"stop","done":true,"total_duration":79123456789,"load_duration":12345678,)"
+               R"("prompt_eval_count":1024,"prompt_eval_duration":345678901,"eval_count":50000,"eval_duration":78012345678})";
+    mStream += '\n';
+}
+
+void NdjsonReaderTest::splitAcrossAppends()
+{
+    const QByteArray data = "{\"status\":\"pulling\"}\n{\"status\":\"verifying\",\"completed\":12,\"total\":34}\n";
+
+    // Every possible split point, down to a single byte per append
+    NdjsonReader reader;
+    QList<QByteArray> lines;
+    for (const auto c: data)
+    {
+        reader.append(QByteArray(1, c));
+        lines += readAll(reader);
+    }
+
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines.at(0), QByteArray("{\"status\":\"pulling\"}"));
+
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(lines.at(1), chunk));
+    QCOMPARE(chunk.status, QStringLiteral("verifying"));
+    QCOMPARE(chunk.completed, Q_INT64_C(12));
+    QCOMPARE(chunk.total, Q_INT64_C(34));
+
+    for (int split=1; split<data.size(); split++)
+    {
+        NdjsonReader split2;
+        split2.append(data.left(split));
+        auto parts = readAll(split2);
+        split2.append(data.mid(split));
+        parts += readAll(split2);
+        QCOMPARE(parts.count(), 2);
+        QCOMPARE(parts.at(0) + '\n' + parts.at(1) + '\n', data);
+    }
+}
+
+void NdjsonReaderTest::crlf()
+{
+    NdjsonReader reader;
+    reader.append("{\"done\":false}\r");
+    QVERIFY(readAll(reader).isEmpty());
+    reader.append("\n{\"done\":true}\r\n");
+
+    const auto lines = readAll(reader);
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines.at(0), QByteArray("{\"done\":false}"));
+    QCOMPARE(lines.at(1), QByteArray("{\"done\":true}"));
+}
+
+void NdjsonReaderTest::emptyLines()
+{
+    NdjsonReader reader;
+    reader.append("\n\r\n{\"done\":true}\n\n");
+
+    const auto lines = readAll(reader);
+    QCOMPARE(lines.count(), 1);
+    QCOMPARE(lines.at(0), QByteArray("{\"done\":true}"));
+}
+
+void NdjsonReaderTest::flushFinalLine()
+{
+    NdjsonReader reader;
+    reader.append("{\"done\":false}\n{\"done\":true}");
+
+    QCOMPARE(readAll(reader).count(), 1);
+
+    // The last line is only complete once the reply has finished
+    QByteArray line;
+    QVERIFY(!reader.readLine(line));
+    QVERIFY(reader.readLine(line, true));
+    QCOMPARE(line, QByteArray("{\"done\":true}"));
+    QVERIFY(!reader.readLine(line, true));
+
+    NdjsonReader crlf;
+    crlf.append("{\"done\":true}\r");
+    QCOMPARE(readAll(crlf, true), QList<QByteArray>({"{\"done\":true}"}));
+}
+
+void NdjsonReaderTest::compaction()
+{
+    // A line longer than the compaction threshold followed by the start
+    // of the next one. The next append moves the unread rest to the front.
+    const auto big = "{\"message\":{\"content\":\"" + QByteArray(6000, 'x') + "\"}}";
+    const QByteArray next = "{\"message\":{\"content\":\"after\"},\"done\":true}";
+
+    NdjsonReader reader;
+    reader.append(big + '\n' + next.left(10));
+    QCOMPARE(readAll(reader), QList<QByteArray>({big}));
+
+    reader.append(next.mid(10, 10));
+    QVERIFY(readAll(reader).isEmpty());
+    reader.append(next.mid(20) + "\n");
+
+    const auto lines = readAll(reader);
+    QCOMPARE(lines, QList<QByteArray>({next}));
+
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(lines.first(), chunk));
+    QCOMPARE(chunk.content, QStringLiteral("after"));
+    QVERIFY(chunk.done);
+
+    // Many lines through one reader, compacting again and again
+    NdjsonReader many;
+    QList<QByteArray> expected;
+    QList<QByteArray> lines2;
+    for (int i=0; i<2000; i++)
+    {
+        const auto line = "{\"message\":{\"content\":\"" + QByteArray::number(i) + "\"}}";
+        expected << line;
+        many.append(line.left(7));
+        lines2 += readAll(many);
+        many.append(line.mid(7) + '\n');
+        lines2 += readAll(many);
+    }
+    QCOMPARE(lines2, expected);
+}
+
+void NdjsonReaderTest::escapedQuotes()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(R"({"message":{"role":"assistant","content":"say \"hi\", a \\ and \/ \"end\""},"done":false})", chunk));
+    QCOMPARE(chunk.role, QStringLiteral("assistant"));
+    QCOMPARE(chunk.content, QStringLiteral("say \"hi\", a \\ and / \"end\""));
+    QVERIFY(!chunk.done);
+
+    // An escaped backslash right before the closing quote ends the string
+    QVERIFY(NdjsonReader::parse(R"({"message":{"content":"dir\\"},"model":"m"})", chunk));
+    QCOMPARE(chunk.content, QStringLiteral("dir\\"));
+    QCOMPARE(chunk.model, QStringLiteral("m"));
+
+    QVERIFY(NdjsonReader::parse(R"({"message":{"content":"a\nb\tc\r\b\f"}})", chunk));
+    QCOMPARE(chunk.content, QStringLiteral("a\nb\tc\r\b\f"));
+
+    // Escaped quotes inside keys and skipped values
+    QVERIFY(NdjsonReader::parse(R"({"x\"y":"skip \"me\"","status":"ok"})", chunk));
+    QCOMPARE(chunk.status, QStringLiteral("ok"));
+}
+
+void NdjsonReaderTest::unicodeEscapes()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(R"({"message":{"content":"caf\u00e9 \u00E9"}})", chunk));
+    QCOMPARE(chunk.content, QString::fromUtf8("caf\xc3\xa9 \xc3\xa9"));
+
+    // A surrogate pair is two escapes and has to end up as one character
+    QVERIFY(NdjsonReader::parse(R"({"message":{"content":"smile \ud83d\ude00!"}})", chunk));
+    const auto smile = QString::fromUtf8("smile \xf0\x9f\x98\x80!");
+    QCOMPARE(chunk.content, smile);
+    QCOMPARE(chunk.content.toUcs4().count(), 8);
+
+    // Escapes mixed with raw UTF-8 around them
+    QVERIFY(NdjsonReader::parse("{\"message\":{\"content\":\"\xd8\xb3\\u0644\xd8\xa7\\u0645\"}}", chunk));
+    QCOMPARE(chunk.content, QString::fromUtf8("\xd8\xb3\xd9\x84\xd8\xa7\xd9\x85"));
+
+    QVERIFY(!NdjsonReader::parse(R"({"message":{"content":"\u00"}})", chunk));
+    QVERIFY(!NdjsonReader::parse(R"({"message":{"content":"\uzzzz"}})", chunk));
+}
+
+void NdjsonReaderTest::rawUtf8()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse("{\"message\":{\"content\":\"\xe2\x9c\x93 \xf0\x9f\x98\x80\"}}", chunk));
+    QCOMPARE(chunk.content, QString::fromUtf8("\xe2\x9c\x93 \xf0\x9f\x98\x80"));
+}
+
+void NdjsonReaderTest::numbersAndFlags()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(R"({"done":true,"total_duration":79123456789,"load_duration":-5,"prompt_eval_count":1024,)"
+                                R"("prompt_eval_duration":3.5e2,"eval_count":0,"eval_duration":7801})", chunk));
+    QVERIFY(chunk.done);
+    QCOMPARE(chunk.totalDuration, Q_INT64_C(79123456789));
+    QCOMPARE(chunk.loadDuration, Q_INT64_C(-5));
+    QCOMPARE(chunk.promptEvalCount, Q_INT64_C(1024));
+    QCOMPARE(chunk.promptEvalDuration, Q_INT64_C(3));
+    QCOMPARE(chunk.evalCount, Q_INT64_C(0));
+    QCOMPARE(chunk.evalDuration, Q_INT64_C(7801));
+}
+
+void NdjsonReaderTest::unknownKeys()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(NdjsonReader::parse(R"({"created_at":"2024","context":[1,2,[3,{"a":null}]],"details":{"x":{"y":[]}},)"
+                                R"("message":{"images":null,"tool_calls":[{"function":{"name":"f"}}],"content":"ok"},"done":false})", chunk));
+    QCOMPARE(chunk.content, QStringLiteral("ok"));
+    QVERIFY(!chunk.done);
+
+    QVERIFY(NdjsonReader::parse(R"(  { "error" : "model not found" }  )", chunk));
+    QCOMPARE(chunk.error, QStringLiteral("model not found"));
+}
+
+void NdjsonReaderTest::invalidLines()
+{
+    NdjsonReader::Chunk chunk;
+    QVERIFY(!NdjsonReader::parse("", chunk));
+    QVERIFY(!NdjsonReader::parse("not json", chunk));
+    QVERIFY(!NdjsonReader::parse(R"({"message":{"content":"open)", chunk));
+    QVERIFY(!NdjsonReader::parse(R"({"done":true} trailing)", chunk));
+    QVERIFY(!NdjsonReader::parse(R"({"done":true)", chunk));
+}
+
+void NdjsonReaderTest::benchmarkStream()
+{
+    qint32 lines = 0;
+    qint64 evalCount = 0;
+    QBENCHMARK
+    {
+        NdjsonReader reader;
+        QString content;
+        QByteArray line;
+        NdjsonReader::Chunk chunk;
+        lines = 0;
+
+        for (qsizetype pos = 0; pos < mStream.size(); pos += STREAM_PIECE_SIZE)
+        {
+            reader.append(mStream.mid(pos, STREAM_PIECE_SIZE));
+            while (reader.readLine(line))
+            {
+                QVERIFY(NdjsonReader::parse(line, chunk));
+                content += chunk.content;
+                evalCount = chunk.evalCount;
+                lines++;
+            }
+        }
+        while (reader.readLine(line, true))
+            lines++;
+    }
+
+    QCOMPARE(lines, STREAM_TOKENS + 1);
+    QCOMPARE(evalCount, qint64(STREAM_TOKENS));
+}
+
+QTEST_GUILESS_MAIN(NdjsonReaderTest)
+#include "tst_ndjsonreader.moc"
@@ -0,0 +1,230 @@
+#include <QtTest>
+
+#include "textrope.h"
+
+// Same as in textrope.cpp
+#define ROPE_CHUNK_SIZE 4096
+
+class TextRopeTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void multiByteAtChunkBoundary();
+    void multiByteAcrossAppends();
+    void chopTrailingSpaces();
+    void chopEmptyLastChunk();
+    void toStringFrom();
+    void revision();
+    void sharedCopies();
+
+private:
+    static void verifyChunks(const TextRope &rope, const QString &text);
+};
+
+void TextRopeTest::verifyChunks(const TextRope &rope, const QString &text)
+{
+    // Every chunk is bounded and holds whole characters only
+    QByteArray all;
+    for (const auto &chunk: rope.chunks())
+    {
+        QVERIFY(chunk.size() > 0);
+        QVERIFY(chunk.size() <= ROPE_CHUNK_SIZE);
+        QCOMPARE(QString::fromUtf8(chunk).toUtf8(), chunk);
+        all += chunk;
+    }
+
+    QCOMPARE(all, text.toUtf8());
+    QCOMPARE(rope.toUtf8(), text.toUtf8());
+    QCOMPARE(rope.toString(), text);
+    QCOMPARE(rope.size(), qint64(text.toUtf8().size()));
+}
+
+void TextRopeTest::multiByteAtChunkBoundary()
+{
+    // Two, three and four byte characters, starting a few bytes before the
+    // end of the first chunk up to right at its end
+    const QList<QString> characters = {
+        QString::fromUtf8("\xc3\xa9"),
+        QString::fromUtf8("\xe2\x9c\x93"),
+        QString::fromUtf8("\xf0\x9f\x98\x80"),
+    };
+    for (const auto &ch: characters)
+    {
+        for (int before=ROPE_CHUNK_SIZE-4; before<=ROPE_CHUNK_SIZE; before++)
+        {
+            const auto text = QString(before, QLatin1Char('a')) + ch + ch + QStringLiteral("z");
+
+            TextRope rope;
+            rope.append(text);
+            verifyChunks(rope, text);
+            QCOMPARE(rope.chunks().count(), 2);
+
+            // Only a character that does not fit moves on, whole
+            QVERIFY(rope.chunks().first().size() > ROPE_CHUNK_SIZE - ch.toUtf8().size());
+        }
+    }
+
+    // Many chunks in one go
+    QString text;
+    for (int i=0; i<5000; i++)
+        text += characters.at(i % characters.count());
+    const TextRope rope(text);
+    verifyChunks(rope, text);
+    QVERIFY(rope.chunks().count() > 3);
+}
+
+void TextRopeTest::multiByteAcrossAppends()
+{
+    const auto smile = QString::fromUtf8("\xf0\x9f\x98\x80");
+
+    // One character per append, the way a stream delivers tokens
+    TextRope rope;
+    QString text;
+    for (int i=0; i<3000; i++)
+    {
+        const auto piece = (i % 3)? smile : QString::fromUtf8("x\xc3\xa9");
+        rope.append(piece);
+        text += piece;
+    }
+    verifyChunks(rope, text);
+
+    // A full last chunk followed by a multi byte character
+    TextRope full(QString(ROPE_CHUNK_SIZE, QLatin1Char('a')));
+    QCOMPARE(full.chunks().count(), 1);
+    full += smile;
+    verifyChunks(full, QString(ROPE_CHUNK_SIZE, QLatin1Char('a')) + smile);
+    QCOMPARE(full.chunks().count(), 2);
+    QCOMPARE(full.chunks().last().size(), 4);
+}
+
+void TextRopeTest::chopTrailingSpaces()
+{
+    TextRope rope(QString::fromUtf8("answer \xc3\xa9 \n\t \xe3\x80\x80"));
+    rope.chopTrailingSpaces();
+    verifyChunks(rope, QString::fromUtf8("answer \xc3\xa9"));
+
+    // Nothing to chop leaves the text as it is
+    const auto revision = rope.revision();
+    rope.chopTrailingSpaces();
+    QCOMPARE(rope.revision(), revision);
+    verifyChunks(rope, QString::fromUtf8("answer \xc3\xa9"));
+
+    TextRope spaces(QStringLiteral(" \n "));
+    spaces.chopTrailingSpaces();
+    QVERIFY(spaces.isEmpty());
+    QVERIFY(spaces.chunks().isEmpty());
+    QCOMPARE(spaces.toString(), QString());
+
+    TextRope empty;
+    empty.chopTrailingSpaces();
+    QVERIFY(empty.isEmpty());
+    QCOMPARE(empty.revision(), quint32(0));
+}
+
+void TextRopeTest::chopEmptyLastChunk()
+{
+    // The last chunk holds only white space and ends up empty, the chop
+    // goes on into the chunk before it
+    const auto body = QString(ROPE_CHUNK_SIZE - 2, QLatin1Char('x'));
+    TextRope rope(body + QStringLiteral("  \n\n"));
+    QCOMPARE(rope.chunks().count(), 2);
+    QCOMPARE(rope.chunks().last(), QByteArray("\n\n"));
+
+    const auto revision = rope.revision();
+    rope.chopTrailingSpaces();
+    QVERIFY(rope.revision() != revision);
+    QCOMPARE(rope.chunks().count(), 1);
+    verifyChunks(rope, body);
+
+    // Appending afterwards fills the chunk that is now last again
+    rope.append(QStringLiteral("yz"));
+    QCOMPARE(rope.chunks().count(), 1);
+    verifyChunks(rope, body + QStringLiteral("yz"));
+
+    // A multi byte space that moved to a chunk of its own
+    const auto full = QString(ROPE_CHUNK_SIZE - 1, QLatin1Char('x'));
+    TextRope ideographic(full + QString::fromUtf8("\xe3\x80\x80"));
+    QCOMPARE(ideographic.chunks().count(), 2);
+    ideographic.chopTrailingSpaces();
+    QCOMPARE(ideographic.chunks().count(), 1);
+    verifyChunks(ideographic, full);
+}
+
+void TextRopeTest::toStringFrom()
+{
+    const auto first = QString(ROPE_CHUNK_SIZE - 1, QLatin1Char('a'));
+    const auto second = QString::fromUtf8("\xc3\xa9" "bc\xf0\x9f\x98\x80" "d");
+    TextRope rope(first);
+    rope.append(second);
+    QCOMPARE(rope.chunks().count(), 2);
+
+    // Offsets are in bytes and point into the second chunk
+    const qint64 start = first.size();
+    QCOMPARE(rope.toString(start), second);
+    QCOMPARE(rope.toString(start + 2), QString::fromUtf8("bc\xf0\x9f\x98\x80" "d"));
+    QCOMPARE(rope.toString(start + 4), QString::fromUtf8("\xf0\x9f\x98\x80" "d"));
+    QCOMPARE(rope.toString(start + 8), QStringLiteral("d"));
+    QCOMPARE(rope.toString(rope.size()), QString());
+    QCOMPARE(rope.toString(rope.size() + 10), QString());
+
+    // Inside the first chunk the rest of the text follows
+    QCOMPARE(rope.toString(start - 1), QStringLiteral("a") + second);
+    QCOMPARE(rope.toString(), first + second);
+
+    // Further along, past several chunks
+    const auto long1 = QString(3 * ROPE_CHUNK_SIZE + 100, QLatin1Char('b'));
+    TextRope many(long1 + QStringLiteral("tail"));
+    QCOMPARE(many.chunks().count(), 4);
+    QCOMPARE(many.toString(long1.size()), QStringLiteral("tail"));
+}
+
+void TextRopeTest::revision()
+{
+    TextRope rope;
+    const auto initial = rope.revision();
+
+    // Appending keeps the revision, anything else changes it
+    rope.append(QStringLiteral("one"));
+    rope += QStringLiteral(" two ");
+    QCOMPARE(rope.revision(), initial);
+
+    rope.chopTrailingSpaces();
+    const auto chopped = rope.revision();
+    QVERIFY(chopped != initial);
+    QCOMPARE(rope.toString(), QStringLiteral("one two"));
+
+    rope = QStringLiteral("three");
+    const auto assigned = rope.revision();
+    QVERIFY(assigned != chopped);
+    QCOMPARE(rope.toString(), QStringLiteral("three"));
+
+    rope.clear();
+    QVERIFY(rope.revision() != assigned);
+    QVERIFY(rope.isEmpty());
+    QCOMPARE(rope.size(), Q_INT64_C(0));
+    QCOMPARE(rope.toUtf8(), QByteArray());
+
+    // Clearing nothing is not a change
+    const auto cleared = rope.revision();
+    rope.clear();
+    QCOMPARE(rope.revision(), cleared);
+}
+
+void TextRopeTest::sharedCopies()
+{
+    // A copy is a checkpoint, appending to either one leaves the other alone
+    TextRope rope(QString(ROPE_CHUNK_SIZE + 10, QLatin1Char('a')));
+    const auto checkpoint = rope;
+    rope.append(QStringLiteral("more"));
+
+    QCOMPARE(checkpoint.size(), qint64(ROPE_CHUNK_SIZE + 10));
+    verifyChunks(checkpoint, QString(ROPE_CHUNK_SIZE + 10, QLatin1Char('a')));
+    verifyChunks(rope, QString(ROPE_CHUNK_SIZE + 10, QLatin1Char('a')) + QStringLiteral("more"));
+
+    // The full chunk is still the same memory in both
+    QVERIFY(rope.chunks().first().constData() == checkpoint.chunks().first().constData());
+}
+
+QTEST_GUILESS_MAIN(TextRopeTest)
+#include "tst_textrope.moc"
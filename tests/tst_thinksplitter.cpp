@@ -0,0 +1,187 @@
+#include <QtTest>
+
+#include "thinksplitter.h"
+
+class ThinkSplitterTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void splitTagged();
+    void splitPlain();
+    void tagsAcrossDeltas();
+    void startedInReasoning();
+    void notATag();
+    void finishFlushesPending();
+    void finishChopsSpaces();
+    void thinking();
+
+private:
+    static void feedAll(const QStringList &deltas, QString &answer, QString &reasoning);
+};
+
+void ThinkSplitterTest::feedAll(const QStringList &deltas, QString &answer, QString &reasoning)
+{
+    TextRope rope;
+    ThinkSplitter splitter;
+    for (const auto &delta: deltas)
+        splitter.feed(delta, rope, reasoning);
+    splitter.finish(rope, reasoning);
+    answer = rope.toString();
+}
+
+void ThinkSplitterTest::splitTagged()
+{
+    QString answer;
+    QString reasoning;
+    ThinkSplitter::split(QStringLiteral("<think>\nFirst this, then that.\n</think>\n\nThe answer."), answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("The answer."));
+    QCOMPARE(reasoning, QStringLiteral("First this, then that."));
+
+    // An empty think block leaves no reasoning behind
+    answer.clear();
+    reasoning.clear();
+    ThinkSplitter::split(QStringLiteral("<think>\n\n</think>\n\nHello"), answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("Hello"));
+    QCOMPARE(reasoning, QString());
+}
+
+void ThinkSplitterTest::splitPlain()
+{
+    QString answer;
+    QString reasoning;
+    ThinkSplitter::split(QStringLiteral("  Just an answer.\n"), answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("Just an answer."));
+    QCOMPARE(reasoning, QString());
+}
+
+void ThinkSplitterTest::tagsAcrossDeltas()
+{
+    const auto text = QStringLiteral("<think>\nWeigh it up.\n</think>\n\nThe answer, <i>quoted</i>.");
+
+    QString expectedAnswer;
+    QString expectedReasoning;
+    ThinkSplitter::split(text, expectedAnswer, expectedReasoning);
+    QCOMPARE(expectedAnswer, QStringLiteral("The answer, <i>quoted</i>."));
+    QCOMPARE(expectedReasoning, QStringLiteral("Weigh it up."));
+
+    // Every possible split point, down to a single character per delta
+    QStringList characters;
+    for (const auto c: text)
+        characters << QString(c);
+
+    QString answer;
+    QString reasoning;
+    feedAll(characters, answer, reasoning);
+    QCOMPARE(answer, expectedAnswer);
+    QCOMPARE(reasoning, expectedReasoning);
+
+    for (int split=1; split<text.size(); split++)
+    {
+        answer.clear();
+        reasoning.clear();
+        feedAll({text.left(split), text.mid(split)}, answer, reasoning);
+        QCOMPARE(answer, expectedAnswer);
+        QCOMPARE(reasoning, expectedReasoning);
+    }
+}
+
+void ThinkSplitterTest::startedInReasoning()
+{
+    // Without an opening tag everything up to the closing one was reasoning
+    QString answer;
+    QString reasoning;
+    feedAll({QStringLiteral("Let me think"), QStringLiteral(" about it.\n</th"), QStringLiteral("ink>\n\nDone.")}, answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("Done."));
+    QCOMPARE(reasoning, QStringLiteral("Let me think about it."));
+
+    answer.clear();
+    reasoning.clear();
+    ThinkSplitter::split(QStringLiteral("Reasoning.</response>Answer."), answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("Answer."));
+    QCOMPARE(reasoning, QStringLiteral("Reasoning."));
+}
+
+void ThinkSplitterTest::notATag()
+{
+    const auto text = QStringLiteral("a < b, <b>bold</b> and </thinking");
+
+    QString answer;
+    QString reasoning;
+    ThinkSplitter::split(text, answer, reasoning);
+    QCOMPARE(answer, text);
+    QCOMPARE(reasoning, QString());
+
+    answer.clear();
+    feedAll({QStringLiteral("x <"), QStringLiteral("thin"), QStringLiteral("g>")}, answer, reasoning);
+    QCOMPARE(answer, QStringLiteral("x <thing>"));
+    QCOMPARE(reasoning, QString());
+}
+
+void ThinkSplitterTest::finishFlushesPending()
+{
+    // What looked like the start of a tag is text after all once the
+    // stream ends
+    TextRope answer;
+    QString reasoning;
+    ThinkSplitter splitter;
+    splitter.feed(QStringLiteral("answer <thi"), answer, reasoning);
+    QCOMPARE(answer.toString(), QStringLiteral("answer "));
+    splitter.finish(answer, reasoning);
+    QCOMPARE(answer.toString(), QStringLiteral("answer <thi"));
+
+    TextRope answer2;
+    ThinkSplitter splitter2;
+    splitter2.feed(QStringLiteral("<think>hmm </"), answer2, reasoning);
+    splitter2.finish(answer2, reasoning);
+    QVERIFY(answer2.isEmpty());
+    QCOMPARE(reasoning, QStringLiteral("hmm </"));
+}
+
+void ThinkSplitterTest::finishChopsSpaces()
+{
+    TextRope answer;
+    QString reasoning;
+    ThinkSplitter splitter;
+    splitter.feed(QStringLiteral("\n\n  "), answer, reasoning);
+    QVERIFY(answer.isEmpty());
+    splitter.feed(QStringLiteral("An answer"), answer, reasoning);
+    splitter.feed(QStringLiteral(" \n\n"), answer, reasoning);
+    QCOMPARE(answer.toString(), QStringLiteral("An answer \n\n"));
+
+    const auto revision = answer.revision();
+    splitter.finish(answer, reasoning);
+    QCOMPARE(answer.toString(), QStringLiteral("An answer"));
+    QVERIFY(answer.revision() != revision);
+    QCOMPARE(reasoning, QString());
+
+    // A stream that stops while still thinking
+    TextRope answer2;
+    QString reasoning2;
+    ThinkSplitter splitter2;
+    splitter2.feed(QStringLiteral("<think> Still going \n"), answer2, reasoning2);
+    splitter2.finish(answer2, reasoning2);
+    QVERIFY(answer2.isEmpty());
+    QCOMPARE(reasoning2, QStringLiteral("Still going"));
+}
+
+void ThinkSplitterTest::thinking()
+{
+    TextRope answer;
+    QString reasoning;
+    ThinkSplitter splitter;
+    QVERIFY(!splitter.thinking());
+
+    splitter.feed(QStringLiteral("<thi"), answer, reasoning);
+    QVERIFY(!splitter.thinking());
+    splitter.feed(QStringLiteral("nk>Hmm"), answer, reasoning);
+    QVERIFY(splitter.thinking());
+    splitter.feed(QStringLiteral("</think>Yes"), answer, reasoning);
+    QVERIFY(!splitter.thinking());
+
+    QCOMPARE(answer.toString(), QStringLiteral("Yes"));
+    QCOMPARE(reasoning, QStringLiteral("Hmm"));
+}
+
+QTEST_GUILESS_MAIN(ThinkSplitterTest)
+#include "tst_thinksplitter.moc"